@@ -7,221 +7,4894 @@
 #include <stdexcept>  // For exception handling
 #include <cstdlib>    // For rand()
 #include <ctime>      // For time
+#include <cstdint>    // For fixed-width record fields
+#include <fstream>    // For the time-series file
+#include <algorithm>  // For lower_bound in range queries
+#include <cmath>      // For smoothing factors and confidence intervals
+#include <map>        // For the sorted patient ID index
+#include <climits>    // For INT_MAX
+#include <memory>     // For shared_ptr to archive segments
+#include <thread>     // For the background compaction thread
+#include <mutex>
+#include <condition_variable>
+#include <functional> // For std::function callbacks
+#include <atomic>     // For the report work counter
+#include <unordered_map>  // For appointment lookup by patient ID
+#include <new>        // For replacing global operator new/delete
+#include <random>     // For per-run random engines in benchmarks
+#include <chrono>     // For benchmark timing
+#include <array>      // For compile-time seed populations
+#include <bitset>     // For counting free clinicians
+#include <deque>      // For queues that can take patients back at the front
+#include <cstring>    // For memcpy into binary records
+#include <cstdio>     // For removing spilled archive files
+#ifdef __linux__
+#include <sys/resource.h>  // For setpriority
+#include <sys/syscall.h>   // For SYS_gettid
+#include <unistd.h>
+#include <linux/perf_event.h>  // For hardware performance counters
+#include <sys/ioctl.h>
+#include <cerrno>
+#include <csignal>             // For the SIGPROF sampling profiler
+#include <sys/time.h>          // For setitimer
+#include <execinfo.h>          // For backtrace
+#include <dlfcn.h>             // For dladdr
+#include <cxxabi.h>            // For demangling symbol names
+#include <sys/mman.h>          // For mapping dataset files
+#include <fcntl.h>
+#include <sys/wait.h>            // For benchmark cells run in child processes
+#endif
 
 using namespace std;
 
-// Patient Class: Represents a patient with an ID, gender, arrival time, type, and arrival in minutes
+// Memory accounting (opt-in): build with -DPATIENT_MEM_ACCOUNTING to replace the
+// global operator new/delete with versions that charge every heap block to
+// the subsystem active on the allocating thread. Code marks its subsystem
+// with a MemScope and counts the allocations of a call with a MemCall; both
+// compile to nothing when accounting is off.
+enum class MemTag { Other, Queues, History, Indices, TimeSeries, Archive, Ward, Appointments, Parser, Count };
+enum class MemOp { AddPatient, ServePatients, Count };
+
+class MemoryAccounting {
+public:
+    struct TagStats {
+        atomic<long long> live_bytes{0};
+        atomic<long long> peak_bytes{0};
+        atomic<long long> allocations{0};
+        atomic<long long> frees{0};
+    };
+    struct OpStats {
+        atomic<long long> calls{0};
+        atomic<long long> allocations{0};
+        atomic<long long> bytes{0};
+    };
+
+    static TagStats tags[static_cast<int>(MemTag::Count)];
+    static OpStats ops[static_cast<int>(MemOp::Count)];
+    static thread_local MemTag current_tag;          // Subsystem charged for new allocations
+    static thread_local long long thread_allocations; // Allocations made by this thread
+    static thread_local long long thread_bytes;       // Bytes allocated by this thread
+
+    static bool enabled() {
+#ifdef PATIENT_MEM_ACCOUNTING
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static const char* tagName(int tag) {
+        static const char* names[] = {"other", "queues", "history", "indices", "time-series",
+                                      "archive", "ward", "appointments", "parser"};
+        return names[tag];
+    }
+
+    static void recordAllocation(MemTag tag, size_t size) {
+        TagStats& t = tags[static_cast<int>(tag)];
+        long long live = t.live_bytes.fetch_add(static_cast<long long>(size), memory_order_relaxed) + static_cast<long long>(size);
+        long long peak = t.peak_bytes.load(memory_order_relaxed);
+        while (live > peak && !t.peak_bytes.compare_exchange_weak(peak, live, memory_order_relaxed)) {
+        }
+        t.allocations.fetch_add(1, memory_order_relaxed);
+        thread_allocations++;
+        thread_bytes += static_cast<long long>(size);
+    }
+
+    static void recordFree(MemTag tag, size_t size) {
+        TagStats& t = tags[static_cast<int>(tag)];
+        t.live_bytes.fetch_sub(static_cast<long long>(size), memory_order_relaxed);
+        t.frees.fetch_add(1, memory_order_relaxed);
+    }
+
+    // Print live/peak bytes and allocation counts per subsystem, plus allocations per call
+    static void report(ostream& out, long long patients_waiting, long long patients_recorded) {
+        if (!enabled()) {
+            out << "Memory accounting is off; rebuild with -DPATIENT_MEM_ACCOUNTING to enable it.\n";
+            return;
+        }
+        out << "\nMemory by subsystem:\n";
+        out << "Subsystem       LiveBytes   PeakBytes      Allocs       Frees\n";
+        for (int i = 0; i < static_cast<int>(MemTag::Count); i++) {
+            out << left << setw(13) << tagName(i) << right
+                << setw(12) << tags[i].live_bytes.load() << setw(12) << tags[i].peak_bytes.load()
+                << setw(12) << tags[i].allocations.load() << setw(12) << tags[i].frees.load() << "\n";
+        }
+        if (patients_waiting > 0) {
+            out << "Queue bytes per waiting patient: "
+                << tags[static_cast<int>(MemTag::Queues)].live_bytes.load() / patients_waiting << "\n";
+        }
+        if (patients_recorded > 0) {
+            // Archived days keep the blocks they were recorded in, so the archive's records count too
+            long long history_bytes = tags[static_cast<int>(MemTag::History)].live_bytes.load()
+                                    + tags[static_cast<int>(MemTag::Indices)].live_bytes.load()
+                                    + tags[static_cast<int>(MemTag::Archive)].live_bytes.load();
+            out << "History + index + archive bytes per served patient in memory: "
+                << history_bytes / patients_recorded << "\n";
+        }
+        const char* op_names[] = {"addPatient", "servePatients"};
+        for (int i = 0; i < static_cast<int>(MemOp::Count); i++) {
+            long long calls = ops[i].calls.load();
+            if (calls == 0) continue;
+            out << op_names[i] << ": " << fixed << setprecision(2)
+                << static_cast<double>(ops[i].allocations.load()) / calls << " allocations, "
+                << static_cast<double>(ops[i].bytes.load()) / calls << " bytes per call over "
+                << calls << " calls\n";
+        }
+    }
+};
+
+MemoryAccounting::TagStats MemoryAccounting::tags[static_cast<int>(MemTag::Count)];
+MemoryAccounting::OpStats MemoryAccounting::ops[static_cast<int>(MemOp::Count)];
+thread_local MemTag MemoryAccounting::current_tag = MemTag::Other;
+thread_local long long MemoryAccounting::thread_allocations = 0;
+thread_local long long MemoryAccounting::thread_bytes = 0;
+
+#ifdef PATIENT_MEM_ACCOUNTING
+// MemScope: Charges allocations made during its lifetime to one subsystem
+class MemScope {
+    MemTag saved;
+public:
+    explicit MemScope(MemTag tag) : saved(MemoryAccounting::current_tag) { MemoryAccounting::current_tag = tag; }
+    ~MemScope() { MemoryAccounting::current_tag = saved; }
+};
+
+// MemCall: Adds the allocations made during its lifetime to one operation's totals
+class MemCall {
+    MemOp op;
+    long long start_allocations, start_bytes;
+public:
+    explicit MemCall(MemOp op)
+        : op(op), start_allocations(MemoryAccounting::thread_allocations), start_bytes(MemoryAccounting::thread_bytes) {}
+    ~MemCall() {
+        MemoryAccounting::OpStats& s = MemoryAccounting::ops[static_cast<int>(op)];
+        s.calls.fetch_add(1, memory_order_relaxed);
+        s.allocations.fetch_add(MemoryAccounting::thread_allocations - start_allocations, memory_order_relaxed);
+        s.bytes.fetch_add(MemoryAccounting::thread_bytes - start_bytes, memory_order_relaxed);
+    }
+};
+
+// Each block carries a header recording its size and subsystem, so delete can credit it back
+struct alignas(alignof(max_align_t)) MemHeader {
+    size_t size;
+    MemTag tag;
+};
+
+void* operator new(size_t size) {
+    void* block = malloc(sizeof(MemHeader) + size);
+    if (!block) throw bad_alloc();
+    MemHeader* header = static_cast<MemHeader*>(block);
+    header->size = size;
+    header->tag = MemoryAccounting::current_tag;
+    MemoryAccounting::recordAllocation(header->tag, size);
+    return header + 1;
+}
+
+void operator delete(void* p) noexcept {
+    if (!p) return;
+    MemHeader* header = static_cast<MemHeader*>(p) - 1;
+    MemoryAccounting::recordFree(header->tag, header->size);
+    free(header);
+}
+
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+#else
+class MemScope {
+public:
+    explicit MemScope(MemTag) {}
+};
+
+class MemCall {
+public:
+    explicit MemCall(MemOp) {}
+};
+#endif
+
+// Simulation time: milliseconds since the start of day 0, in 64 bits so long horizons cannot overflow.
+// The scheduler advances in ticks of a configurable length (one minute by default).
+typedef int64_t SimTime;
+const SimTime ms_per_second = 1000;
+const SimTime ms_per_minute = 60 * ms_per_second;
+
+// Patient Class: Represents a patient with an ID, gender, arrival time, type, and arrival timestamp
 class Patient {
     string id;               // Patient ID
     char gender;             // 'M' or 'F' for gender
     string arrival_time;     // Arrival time in HH:MM format
     string type;             // Type of patient: "Urgent" or "Normal"
-    int arrival_minute;      // Arrival time in minutes (relative to the start time)
+    SimTime arrival;         // Simulation time the patient joined (milliseconds)
+    uint32_t skills = 0;     // Skills the treating clinician must have (see skill_names)
+    int department = 0;      // Index of the department queue the patient waits in
+
+public:
+    // Constructor to initialize patient details
+    Patient(string id, char gender, string time, string type, SimTime arrival)
+        : id(id), gender(gender), arrival_time(time), type(type), arrival(arrival) {}
+
+    // Getters for patient attributes
+    string getId() const { return id; }
+    char getGender() const { return gender; }
+    string getArrivalTime() const { return arrival_time; }
+    string getType() const { return type; }
+    SimTime getArrivalStamp() const { return arrival; }
+    void setArrivalStamp(SimTime t) { arrival = t; }
+    int64_t getArrivalMinute() const { return arrival / ms_per_minute; }
+    uint32_t getRequiredSkills() const { return skills; }
+    void setRequiredSkills(uint32_t mask) { skills = mask; }
+    int getDepartment() const { return department; }
+    void setDepartment(int index) { department = index; }
+};
+
+// DefaultPolicy: The hospital's scheduling rules, fixed at compile time.
+// Scheduler and PatientGenerator read every rule from their Policy parameter,
+// so with this policy the checks fold to constants in the generated code.
+struct DefaultPolicy {
+    static constexpr int max_wait = 10;              // Longest wait (minutes) before a patient is dropped
+    static constexpr int min_serve = 5;              // Fewest patients served per minute
+    static constexpr int max_serve = 10;             // Most patients served per minute
+    static constexpr int id_length = 14;             // Digits in a generated patient ID
+    static constexpr int id_first_digit_min = 2;     // Generated IDs start with a digit in
+    static constexpr int id_first_digit_max = 3;     //   [id_first_digit_min, id_first_digit_max]
+    static constexpr const char* urgent_type = "Urgent";  // Priority class served first
+    static constexpr const char* normal_type = "Normal";  // Priority class served when urgent is empty
+    static constexpr bool admit_urgent = true;       // Urgent patients need a ward bed after service
+    static constexpr bool admit_normal = false;      // Normal patients go home after service
+    static constexpr int min_stay = 120;             // Shortest bed stay (minutes)
+    static constexpr int max_stay = 480;             // Longest bed stay (minutes)
+};
+
+// RuntimePolicy: Same rules as DefaultPolicy, but assignable at run time for parameter sweeps
+struct RuntimePolicy {
+    static inline int max_wait = DefaultPolicy::max_wait;
+    static inline int min_serve = DefaultPolicy::min_serve;
+    static inline int max_serve = DefaultPolicy::max_serve;
+    static inline int id_length = DefaultPolicy::id_length;
+    static inline int id_first_digit_min = DefaultPolicy::id_first_digit_min;
+    static inline int id_first_digit_max = DefaultPolicy::id_first_digit_max;
+    static inline string urgent_type = DefaultPolicy::urgent_type;
+    static inline string normal_type = DefaultPolicy::normal_type;
+    static inline bool admit_urgent = DefaultPolicy::admit_urgent;
+    static inline bool admit_normal = DefaultPolicy::admit_normal;
+    static inline int min_stay = DefaultPolicy::min_stay;
+    static inline int max_stay = DefaultPolicy::max_stay;
+};
+
+// GeneratorParams: Arrival model and patient mix used by PatientGenerator
+struct GeneratorParams {
+    double arrivals_per_minute = 7.5;  // Mean of the Poisson arrival count per minute
+    double urgent_fraction = 0.5;      // Share of patients that are urgent
+    double female_fraction = 0.5;      // Share of patients that are female
+};
+
+// PatientRecord: Fixed-size binary form of a patient, used by dataset files.
+// Records are plain data with no pointers, so a file of them can be mapped
+// into memory and read in place.
+struct PatientRecord {
+    char id[14];           // Patient ID, NUL-padded when shorter than 14 characters
+    uint16_t clock;        // Reported arrival time of day, in minutes (the HH:MM field)
+    int64_t arrival;       // Simulation time the patient arrives (milliseconds)
+    uint32_t skills;       // Required clinician skills
+    uint16_t department;   // Department index
+    char gender;           // 'M' or 'F'
+    uint8_t urgent;        // 1 for urgent, 0 for normal
+
+    // Pack a patient; throws if the ID does not fit or the clock is not HH:MM
+    static PatientRecord fromPatient(const Patient& p, bool urgent) {
+        PatientRecord r = {};
+        string id = p.getId();
+        if (id.empty() || id.size() > sizeof(r.id)) throw invalid_argument("Patient ID must be 1 to 14 characters.");
+        memcpy(r.id, id.data(), id.size());
+        int hour = 0, minute = 0;
+        char colon = 0;
+        stringstream clock(p.getArrivalTime());
+        if (!(clock >> hour >> colon >> minute) || colon != ':' || hour < 0 || hour > 23 || minute < 0 || minute > 59) {
+            throw invalid_argument("Arrival time must be HH:MM.");
+        }
+        r.clock = static_cast<uint16_t>(hour * 60 + minute);
+        r.arrival = p.getArrivalStamp();
+        r.skills = p.getRequiredSkills();
+        r.department = static_cast<uint16_t>(p.getDepartment());
+        r.gender = p.getGender();
+        r.urgent = urgent ? 1 : 0;
+        return r;
+    }
+
+    Patient toPatient() const {
+        Patient p(string(id, strnlen(id, sizeof(id))), gender, to_string(clock / 60) + ":" + to_string(clock % 60),
+                  urgent ? DefaultPolicy::urgent_type : DefaultPolicy::normal_type, arrival);
+        p.setRequiredSkills(skills);
+        p.setDepartment(department);
+        return p;
+    }
+};
+static_assert(sizeof(PatientRecord) == 32, "PatientRecord is an on-disk format");
+
+// PatientFileHeader: First 64 bytes of a dataset file, followed by record_count PatientRecords
+struct PatientFileHeader {
+    char magic[8];                // "PATREC1" and a NUL
+    uint32_t version;             // Format version, currently 1
+    uint32_t record_size;         // sizeof(PatientRecord)
+    uint64_t record_count;
+    int64_t first_arrival;        // Arrival of the first record (milliseconds)
+    int64_t last_arrival;         // Arrival of the last record; records are in arrival order
+    uint64_t seed;                // Generator seed, 0 if not generated
+    char scenario[16];            // Arrival model the records were generated from, NUL-padded
+
+    static constexpr char expected_magic[8] = {'P', 'A', 'T', 'R', 'E', 'C', '1', '\0'};
+};
+static_assert(sizeof(PatientFileHeader) == 64, "PatientFileHeader is an on-disk format");
+
+// CRandSource: Adapts rand() to the generator interface (call operator returning a random integer)
+struct CRandSource {
+    unsigned operator()() { return static_cast<unsigned>(rand()); }
+};
+
+// PatientGenerator Class: Generates random patient data for simulation
+template <class Policy = DefaultPolicy>
+class BasicPatientGenerator {
+public:
+    // Generate a random patient arriving at the given time
+    static Patient generateRandomPatient(SimTime arrival) {
+        CRandSource rng;
+        return generateRandomPatient(arrival, rng, GeneratorParams());
+    }
+
+    // Generate a random patient arriving at the given time from the given random source and patient mix
+    template <class Rng>
+    static Patient generateRandomPatient(SimTime arrival, Rng& rng, const GeneratorParams& params) {
+        // Random ID whose first digit comes from the policy's range (2 or 3 by default)
+        int first_digit = rng() % (Policy::id_first_digit_max - Policy::id_first_digit_min + 1) + Policy::id_first_digit_min;
+        string id = to_string(first_digit);  // Start the ID with the chosen digit
+
+        // Generate the remaining digits
+        for (int i = 1; i < Policy::id_length; i++) {
+            id += static_cast<char>('0' + rng() % 10);  // Append random digits (0-9)
+        }
+
+        char gender = (rng() % 1000 < params.female_fraction * 1000) ? 'F' : 'M';  // Random gender (M or F)
+        string arrival_time = to_string(rng() % 24) + ":" + to_string(rng() % 60);  // Random time in HH:MM format
+        string type = (rng() % 1000 < params.urgent_fraction * 1000) ? Policy::urgent_type : Policy::normal_type;  // Random priority class
+
+        return Patient(id, gender, arrival_time, type, arrival);  // Return the generated patient
+    }
+
+    // Generate a random patient straight into a binary record, for bulk datasets. Same ID
+    // format and patient mix as generateRandomPatient, with far fewer draws per patient.
+    template <class Rng>
+    static PatientRecord generateRecord(SimTime arrival, Rng& rng, const GeneratorParams& params) {
+        static_assert(Policy::id_length <= sizeof(PatientRecord::id) && Policy::id_length <= 20, "IDs must fit the record");
+        PatientRecord r = {};
+        r.id[0] = static_cast<char>('0' + rng() % (Policy::id_first_digit_max - Policy::id_first_digit_min + 1) + Policy::id_first_digit_min);
+        uint64_t digits = static_cast<uint64_t>(rng()) << 32;
+        digits ^= rng();  // Enough for 19 decimal digits
+        for (int i = 1; i < Policy::id_length; i++) {
+            r.id[i] = static_cast<char>('0' + digits % 10);
+            digits /= 10;
+        }
+        r.gender = (rng() % 1000 < params.female_fraction * 1000) ? 'F' : 'M';
+        int hour = static_cast<int>(rng() % 24);  // Random HH:MM, as for Patient
+        r.clock = static_cast<uint16_t>(hour * 60 + rng() % 60);
+        r.urgent = (rng() % 1000 < params.urgent_fraction * 1000) ? 1 : 0;
+        r.arrival = arrival;
+        return r;
+    }
+
+    // Generate the patients arriving during a tick of length `span` that starts at `at`.
+    // They are stamped with the tick's start, the time the scheduler sees them.
+    template <class Rng>
+    static vector<Patient> generateArrivals(SimTime at, SimTime span, Rng& rng, const GeneratorParams& params) {
+        double mean = params.arrivals_per_minute * span / ms_per_minute;
+        poisson_distribution<int> count(mean > 0 ? mean : 1);
+        int n = mean > 0 ? count(rng) : 0;
+        vector<Patient> patients;
+        patients.reserve(n);
+        for (int i = 0; i < n; i++) {
+            patients.push_back(generateRandomPatient(at, rng, params));
+        }
+        return patients;
+    }
+
+    // Generate a list of patients given a count and start time
+    static vector<Patient> generatePatients(int count, SimTime start) {
+        vector<Patient> patients;
+        for (int i = 0; i < count; i++) {
+            patients.push_back(generateRandomPatient(start));  // Add each random patient to the list
+        }
+        return patients;
+    }
+};
+
+using PatientGenerator = BasicPatientGenerator<DefaultPolicy>;
+
+// SeedPatient: A patient in a compile-time seed population
+struct SeedPatient {
+    char id[DefaultPolicy::id_length + 1];  // NUL-terminated ID in the default format
+    char gender;                            // 'M' or 'F'
+    bool urgent;
+    int arrival_hour;                       // Random HH:MM arrival time, as the generator makes
+    int arrival_min;
+
+    Patient toPatient(SimTime arrival) const {
+        return Patient(id, gender, to_string(arrival_hour) + ":" + to_string(arrival_min),
+                       urgent ? DefaultPolicy::urgent_type : DefaultPolicy::normal_type, arrival);
+    }
+};
+
+// SplitMix64: Small constexpr random generator, so seed data can be built by the compiler
+struct SplitMix64 {
+    uint64_t state;
+    constexpr explicit SplitMix64(uint64_t seed) : state(seed) {}
+    constexpr uint64_t operator()() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+};
+
+// Build N patients with the default ID format and a 50/50 mix, entirely at compile time
+template <size_t N>
+constexpr array<SeedPatient, N> makeSeedPopulation(uint64_t seed) {
+    array<SeedPatient, N> population{};
+    SplitMix64 rng(seed);
+    for (size_t i = 0; i < N; i++) {
+        SeedPatient& p = population[i];
+        p.id[0] = static_cast<char>('0' + DefaultPolicy::id_first_digit_min
+                                    + rng() % (DefaultPolicy::id_first_digit_max - DefaultPolicy::id_first_digit_min + 1));
+        for (int d = 1; d < DefaultPolicy::id_length; d++) {
+            p.id[d] = static_cast<char>('0' + rng() % 10);
+        }
+        p.id[DefaultPolicy::id_length] = '\0';
+        p.gender = rng() % 2 == 0 ? 'M' : 'F';
+        p.urgent = rng() % 2 == 0;
+        p.arrival_hour = static_cast<int>(rng() % 24);
+        p.arrival_min = static_cast<int>(rng() % 60);
+    }
+    return population;
+}
+
+// Fixed seed populations, embedded in the binary as static tables
+constexpr auto startup_population = makeSeedPopulation<100>(20241119);     // Patients waiting when the program starts
+constexpr auto benchmark_population = makeSeedPopulation<1000>(86000087);  // Initial backlog for benchmarks
+
+// Scenario: A standard workload, expressed as PatientGenerator parameters over time
+struct Scenario {
+    const char* name;
+    int minutes;                 // Simulated length of the scenario
+    GeneratorParams base;        // Arrival model outside the burst
+    int burst_start;             // First minute of the burst (-1 for none)
+    int burst_length;            // Minutes the burst lasts
+    GeneratorParams burst;       // Arrival model during the burst
+
+    // Generator parameters in effect at a given minute
+    const GeneratorParams& paramsAt(int minute) const {
+        bool in_burst = burst_start >= 0 && minute >= burst_start && minute < burst_start + burst_length;
+        return in_burst ? burst : base;
+    }
+};
+
+// The canonical scenarios every performance change is measured against
+const Scenario standard_scenarios[] = {
+    // Quiet night: a trickle of mostly normal patients, far below capacity
+    {"quiet-night", 8 * 60, {0.5, 0.2, 0.5}, -1, 0, {}},
+    // Steady day: arrivals just under the mean service capacity of 7.5 per minute
+    {"steady-day", 12 * 60, {6.0, 0.3, 0.5}, -1, 0, {}},
+    // Monday surge: sustained overload for a whole day, with a heavier morning peak
+    {"monday-surge", 24 * 60, {9.0, 0.35, 0.5}, 8 * 60, 3 * 60, {14.0, 0.4, 0.5}},
+    // Mass-casualty burst: normal load interrupted by 20 minutes of mostly urgent arrivals
+    {"mass-casualty", 4 * 60, {4.0, 0.3, 0.5}, 60, 20, {60.0, 0.9, 0.5}},
+};
+
+// QueueSnapshot: Fixed-size record of queue activity for one simulated minute
+struct QueueSnapshot {
+    int32_t minute;            // Simulated minute this record describes
+    int32_t urgent_depth;      // Urgent queue length at the end of the minute
+    int32_t normal_depth;      // Normal queue length at the end of the minute
+    int32_t urgent_arrivals;   // Urgent patients added during the minute
+    int32_t normal_arrivals;   // Normal patients added during the minute
+    int32_t urgent_served;     // Urgent patients served during the minute
+    int32_t normal_served;     // Normal patients served during the minute
+    int32_t urgent_expired;    // Urgent patients dropped after waiting too long
+    int32_t normal_expired;    // Normal patients dropped after waiting too long
+};
+
+// QueueRollup: Downsampled view of several consecutive snapshots
+struct QueueRollup {
+    int start_minute = 0;          // First minute covered by this bucket
+    int samples = 0;               // Number of snapshots folded into the bucket
+    long long urgent_depth_sum = 0;  // Sum of urgent depths (for the average)
+    long long normal_depth_sum = 0;  // Sum of normal depths (for the average)
+    int urgent_depth_max = 0;      // Deepest urgent queue seen in the bucket
+    int normal_depth_max = 0;      // Deepest normal queue seen in the bucket
+    int urgent_arrivals = 0, normal_arrivals = 0;
+    int urgent_served = 0, normal_served = 0;
+    int urgent_expired = 0, normal_expired = 0;
+
+    // Fold one snapshot into the bucket
+    void add(const QueueSnapshot& s) {
+        samples++;
+        urgent_depth_sum += s.urgent_depth;
+        normal_depth_sum += s.normal_depth;
+        urgent_depth_max = max(urgent_depth_max, static_cast<int>(s.urgent_depth));
+        normal_depth_max = max(normal_depth_max, static_cast<int>(s.normal_depth));
+        urgent_arrivals += s.urgent_arrivals;
+        normal_arrivals += s.normal_arrivals;
+        urgent_served += s.urgent_served;
+        normal_served += s.normal_served;
+        urgent_expired += s.urgent_expired;
+        normal_expired += s.normal_expired;
+    }
+};
+
+// QueueTimeSeries Class: Append-only per-minute history of queue activity.
+// Snapshots are kept in memory for range queries and, when a file is attached,
+// appended to it as fixed-size binary records. The 5-minute and hourly rollups
+// are updated as each snapshot arrives, so they never need recomputing.
+class QueueTimeSeries {
+    vector<QueueSnapshot> snapshots;   // All snapshots, ordered by minute
+    vector<QueueRollup> five_minute;   // 5-minute rollups
+    vector<QueueRollup> hourly;        // Hourly rollups
+    ofstream file;                     // Optional binary output file
+
+    // Add a snapshot to the rollup series with the given bucket width
+    static void fold(vector<QueueRollup>& series, int width, const QueueSnapshot& s) {
+        int start = s.minute - s.minute % width;
+        if (series.empty() || series.back().start_minute != start) {
+            QueueRollup bucket;
+            bucket.start_minute = start;
+            series.push_back(bucket);
+        }
+        series.back().add(s);
+    }
+
+public:
+    // Attach a binary file that every new snapshot is appended to
+    bool open(const string& path) {
+        file.open(path, ios::binary | ios::trunc);
+        return file.is_open();
+    }
+
+    // Append the snapshot for the next minute
+    void append(const QueueSnapshot& s) {
+        if (!snapshots.empty() && s.minute <= snapshots.back().minute) {
+            throw invalid_argument("Time-series snapshots must be appended in minute order.");
+        }
+        snapshots.push_back(s);
+        fold(five_minute, 5, s);
+        fold(hourly, 60, s);
+        if (file.is_open()) {
+            file.write(reinterpret_cast<const char*>(&s), sizeof(s));
+            file.flush();  // Keep the file readable while the simulation is running
+        }
+    }
+
+    // Return all snapshots with from <= minute < to
+    vector<QueueSnapshot> range(int from, int to) const {
+        auto by_minute = [](const QueueSnapshot& s, int m) { return s.minute < m; };
+        auto first = lower_bound(snapshots.begin(), snapshots.end(), from, by_minute);
+        auto last = lower_bound(first, snapshots.end(), to, by_minute);
+        return vector<QueueSnapshot>(first, last);
+    }
+
+    // Hand over the in-memory snapshots and start an empty series (the file keeps growing)
+    vector<QueueSnapshot> takeSnapshots() {
+        vector<QueueSnapshot> taken;
+        taken.swap(snapshots);
+        five_minute.clear();
+        hourly.clear();
+        return taken;
+    }
+
+    const vector<QueueSnapshot>& all() const { return snapshots; }
+    const vector<QueueRollup>& fiveMinute() const { return five_minute; }
+    const vector<QueueRollup>& hourlyRollup() const { return hourly; }
+    bool empty() const { return snapshots.empty(); }
+};
+
+// Index of the lowest set bit in a non-zero 64-bit word
+inline int lowestSetBit(uint64_t word) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int index = 0;
+    while (!(word & 1)) {
+        word >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+// Index of the highest set bit in a non-zero 64-bit word
+inline int highestSetBit(uint64_t word) {
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(word);
+#else
+    int index = 0;
+    while (word >>= 1) index++;
+    return index;
+#endif
+}
+
+// Convert an "HH:MM" clock time into minutes after midnight (simulation minute 0 is 00:00).
+// Hours run 00-23; "24:00" is accepted as the end of the day, for the end of a time window.
+int parseClock(const string& clock) {
+    size_t colon = clock.find(':');
+    if (colon == string::npos) {
+        throw invalid_argument("Time must be in HH:MM format.");
+    }
+    int hours = 0, minutes = 0;
+    try {
+        hours = stoi(clock.substr(0, colon));
+        minutes = stoi(clock.substr(colon + 1));
+    } catch (const out_of_range&) {
+        hours = -1;  // Far too large; rejected below
+    }
+    if (hours < 0 || minutes < 0 || minutes > 59 || hours > 24 || (hours == 24 && minutes != 0)) {
+        throw invalid_argument("Time must be in HH:MM format, from 00:00 to 24:00.");
+    }
+    return hours * 60 + minutes;
+}
+
+// ServedRecord: One served patient as stored in the history (32 bytes, no heap storage)
+struct ServedRecord {
+    char id[14];          // Patient ID, NUL-padded when shorter than 14 characters
+    char gender;          // 'M' or 'F'
+    bool urgent;          // True for urgent patients
+    SimTime arrival;      // Time the patient joined a queue
+    SimTime served;       // Time the patient was served
+
+    // Build a record; throws if the ID does not fit
+    static ServedRecord make(const string& id, char gender, bool urgent, SimTime arrival, SimTime served) {
+        ServedRecord r = {};
+        if (id.empty() || id.size() > sizeof(r.id)) throw invalid_argument("Patient ID must be 1 to 14 characters.");
+        memcpy(r.id, id.data(), id.size());
+        r.gender = gender;
+        r.urgent = urgent;
+        r.arrival = arrival;
+        r.served = served;
+        return r;
+    }
+
+    string idString() const { return string(id, find(id, id + sizeof(id), '\0') - id); }
+    SimTime wait() const { return served - arrival; }
+    int64_t servedMinute() const { return served / ms_per_minute; }
+};
+static_assert(sizeof(ServedRecord) == 32, "ServedRecord is kept by the hundred million");
+
+// HistoryQuery: Filter for ServedHistory::query (0 means "any" for type and gender)
+struct HistoryQuery {
+    int64_t from_minute = 0;          // First served minute to include
+    int64_t to_minute = INT64_MAX;    // First served minute to exclude
+    char type = 0;              // 'U' for urgent, 'N' for normal
+    char gender = 0;            // 'M' or 'F'
+};
+
+// ServedHistory Class: Indexed store of every served patient.
+// Records are appended in served order and split into hourly partitions, each
+// with bitmaps marking urgent and female records, so a time-window query only
+// touches the partitions it overlaps and filters 64 records per word. When a
+// partition closes, its record offsets are sorted by ID, so a lookup by patient
+// is a binary search per closed hour plus a scan of the open one. Per-second
+// wait buckets give the longest waits without sorting. Records are fixed-size
+// and indices 32-bit, about 40 bytes per served patient in all.
+class ServedHistory {
+    struct Partition {
+        int64_t start_minute;          // First minute of the hour this partition covers
+        size_t first;                  // Index of the partition's first record
+        size_t count = 0;              // Number of records in the partition
+        vector<uint64_t> urgent_bits;  // Bit i set if record first+i is urgent
+        vector<uint64_t> female_bits;  // Bit i set if record first+i is female
+        vector<uint32_t> by_id;        // Record offsets sorted by ID; filled when the partition closes
+    };
+
+    vector<ServedRecord> records;            // All records, in served order
+    vector<Partition> partitions;            // Hourly partitions over records
+    vector<vector<uint32_t>> by_wait;        // Wait in whole seconds -> record indices
+
+    static bool idLess(const ServedRecord& a, const ServedRecord& b) { return memcmp(a.id, b.id, sizeof(a.id)) < 0; }
+
+    // Sort the last partition's offsets by ID; stable, so repeat visits stay oldest first
+    void closePartition() {
+        MemScope index_scope(MemTag::Indices);
+        Partition& part = partitions.back();
+        part.by_id.resize(part.count);
+        for (size_t i = 0; i < part.count; i++) part.by_id[i] = static_cast<uint32_t>(i);
+        const ServedRecord* base = &records[part.first];
+        stable_sort(part.by_id.begin(), part.by_id.end(),
+                    [base](uint32_t a, uint32_t b) { return idLess(base[a], base[b]); });
+    }
+
+public:
+    // Append a served patient (served times must not go backwards)
+    void add(const ServedRecord& r) {
+        if (!records.empty() && r.served < records.back().served) {
+            throw invalid_argument("History records must be added in served order.");
+        }
+        size_t index = records.size();
+        if (index >= UINT32_MAX) throw runtime_error("History is full; indices are 32-bit.");
+        MemScope history_scope(MemTag::History);
+        records.push_back(r);
+
+        MemScope index_scope(MemTag::Indices);  // Partitions, bitmaps and lookup indices
+        int64_t hour_start = r.servedMinute() - r.servedMinute() % 60;
+        if (partitions.empty() || partitions.back().start_minute != hour_start) {
+            if (!partitions.empty()) closePartition();
+            Partition part;
+            part.start_minute = hour_start;
+            part.first = index;
+            partitions.push_back(part);
+        }
+        Partition& part = partitions.back();
+        size_t bit = part.count++;
+        if (bit % 64 == 0) {
+            part.urgent_bits.push_back(0);
+            part.female_bits.push_back(0);
+        }
+        if (r.urgent) part.urgent_bits.back() |= uint64_t(1) << (bit % 64);
+        if (r.gender == 'F' || r.gender == 'f') part.female_bits.back() |= uint64_t(1) << (bit % 64);
+
+        size_t wait = r.wait() < 0 ? 0 : static_cast<size_t>(r.wait() / ms_per_second);
+        if (by_wait.size() <= wait) by_wait.resize(wait + 1);
+        by_wait[wait].push_back(static_cast<uint32_t>(index));
+    }
+
+    // Indices of every record for the given patient ID, oldest first
+    vector<size_t> findById(const string& id) const {
+        vector<size_t> result;
+        if (id.empty() || id.size() > sizeof(ServedRecord::id)) return result;
+        ServedRecord key = {};
+        memcpy(key.id, id.data(), id.size());
+        for (size_t p = 0; p < partitions.size(); p++) {
+            const Partition& part = partitions[p];
+            const ServedRecord* base = &records[part.first];
+            if (p + 1 == partitions.size()) {
+                // The open partition has no ID index yet
+                for (size_t i = 0; i < part.count; i++) {
+                    if (memcmp(base[i].id, key.id, sizeof(key.id)) == 0) result.push_back(part.first + i);
+                }
+                continue;
+            }
+            auto first = lower_bound(part.by_id.begin(), part.by_id.end(), key,
+                                     [base](uint32_t i, const ServedRecord& k) { return idLess(base[i], k); });
+            for (; first != part.by_id.end() && memcmp(base[*first].id, key.id, sizeof(key.id)) == 0; ++first) {
+                result.push_back(part.first + *first);
+            }
+        }
+        return result;
+    }
+
+    // Indices of the records matching the query, in served order
+    vector<size_t> query(const HistoryQuery& q) const {
+        vector<size_t> result;
+        auto by_start = [](const Partition& p, int64_t m) { return p.start_minute < m; };
+        // Start at the partition containing from_minute
+        int64_t first_hour = max<int64_t>(q.from_minute, 0) / 60 * 60;
+        auto it = lower_bound(partitions.begin(), partitions.end(), first_hour, by_start);
+        for (; it != partitions.end() && it->start_minute < q.to_minute; ++it) {
+            // Only partitions cut by the window need per-record time checks
+            bool whole = it->start_minute >= q.from_minute && it->start_minute + 60 <= q.to_minute;
+            for (size_t w = 0; w < it->urgent_bits.size(); w++) {
+                uint64_t mask = (w + 1) * 64 <= it->count ? ~uint64_t(0) : (uint64_t(1) << (it->count % 64)) - 1;
+                if (q.type == 'U') mask &= it->urgent_bits[w];
+                if (q.type == 'N') mask &= ~it->urgent_bits[w];
+                if (q.gender == 'F') mask &= it->female_bits[w];
+                if (q.gender == 'M') mask &= ~it->female_bits[w];
+                while (mask) {
+                    size_t index = it->first + w * 64 + lowestSetBit(mask);
+                    mask &= mask - 1;  // Clear the lowest set bit
+                    int64_t m = records[index].servedMinute();
+                    if (whole || (m >= q.from_minute && m < q.to_minute)) {
+                        result.push_back(index);
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+    // Indices of the k longest-waiting served patients, longest first
+    vector<size_t> longestWaits(size_t k) const {
+        vector<size_t> result;
+        for (size_t wait = by_wait.size(); wait-- > 0 && result.size() < k;) {
+            for (uint32_t index : by_wait[wait]) {
+                if (result.size() == k) break;
+                result.push_back(index);
+            }
+        }
+        return result;
+    }
+
+    const ServedRecord& at(size_t index) const { return records[index]; }
+    size_t size() const { return records.size(); }
+};
+
+// DayCounters: Totals for the days covered by an archive segment
+struct DayCounters {
+    long long arrivals = 0;       // Patients added to either queue
+    long long urgent_arrivals = 0;
+    long long served = 0;         // Patients served
+    long long expired = 0;        // Patients dropped after waiting too long
+    long long waiting_time = 0;   // Sum of waits of served patients (milliseconds)
+
+    void add(const DayCounters& other) {
+        arrivals += other.arrivals;
+        urgent_arrivals += other.urgent_arrivals;
+        served += other.served;
+        expired += other.expired;
+        waiting_time += other.waiting_time;
+    }
+};
+
+// ArchiveSegment: Immutable record of one or more finished days. A spilled segment keeps
+// only its days and counters in memory; ArchiveStore::load reads the rest back from its file.
+struct ArchiveSegment {
+    int first_day = 0;                 // First day covered (day 0 starts at minute 0)
+    int last_day = 0;                  // Last day covered, inclusive
+    ServedHistory history;             // Patients served during those days
+    vector<QueueSnapshot> minute_log;  // Per-minute queue snapshots for those days
+    DayCounters counters;              // Totals over those days
+    string spill_path;                 // File holding history and minute_log, if spilled
+
+    bool spilled() const { return !spill_path.empty(); }
+};
+
+// ArchiveFileHeader: Start of a spilled segment file, followed by the served records and the minute log
+struct ArchiveFileHeader {
+    char magic[8];              // "ARCSEG1\0"
+    int32_t first_day, last_day;
+    uint64_t record_count;
+    uint64_t snapshot_count;
+};
+
+// ArchiveStore Class: Holds the archived days and compacts them in the background.
+// The scheduler hands over a finished day by moving its containers into
+// submit(), which only takes a short lock. A low-priority worker thread seals
+// the day into an immutable segment and merges runs of daily segments into
+// weekly ones, so the tick never waits for archiving work. With a spill prefix
+// set, each weekly segment is written to its own file and only its counters stay
+// in memory, so memory holds at most about a week of days however long the run.
+class ArchiveStore {
+    struct PendingDay {
+        int day;
+        ServedHistory history;
+        vector<QueueSnapshot> minute_log;
+    };
+
+    static const int days_per_compacted_segment = 7;
+
+    mutable mutex lock;                                // Guards the fields below
+    condition_variable wake;                           // Signals new work or shutdown
+    vector<PendingDay> pending;                        // Days waiting to be sealed
+    vector<shared_ptr<const ArchiveSegment>> segments; // Sealed segments, oldest first
+    bool stopping = false;
+    string spill_prefix;                               // Weekly segments go to files named from this, if set
+    vector<string> spill_files;                        // Files written, removed with the store
+    thread worker;                                     // Started on the first submit
+
+    // Write a segment's history and minute log to a file; returns the in-memory stub that replaces
+    // it, or the segment itself if the file could not be written
+    shared_ptr<const ArchiveSegment> spill(const shared_ptr<const ArchiveSegment>& segment, const string& prefix) {
+        string path = prefix + "days_" + to_string(segment->first_day) + "-" + to_string(segment->last_day) + ".dat";
+        ofstream out(path, ios::binary | ios::trunc);
+        ArchiveFileHeader header = {};
+        memcpy(header.magic, "ARCSEG1", 8);
+        header.first_day = segment->first_day;
+        header.last_day = segment->last_day;
+        header.record_count = segment->history.size();
+        header.snapshot_count = segment->minute_log.size();
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (size_t i = 0; i < segment->history.size(); i++) {
+            out.write(reinterpret_cast<const char*>(&segment->history.at(i)), sizeof(ServedRecord));
+        }
+        out.write(reinterpret_cast<const char*>(segment->minute_log.data()),
+                  static_cast<streamsize>(segment->minute_log.size() * sizeof(QueueSnapshot)));
+        out.close();
+        if (!out) {
+            remove(path.c_str());
+            return segment;  // Keep it in memory rather than lose it
+        }
+        auto stub = make_shared<ArchiveSegment>();
+        stub->first_day = segment->first_day;
+        stub->last_day = segment->last_day;
+        stub->counters = segment->counters;
+        stub->spill_path = path;
+        lock_guard<mutex> guard(lock);
+        spill_files.push_back(path);
+        return stub;
+    }
+
+    // Build an immutable segment for one finished day
+    static shared_ptr<const ArchiveSegment> seal(PendingDay& day) {
+        auto segment = make_shared<ArchiveSegment>();
+        segment->first_day = segment->last_day = day.day;
+        for (const auto& s : day.minute_log) {
+            segment->counters.arrivals += s.urgent_arrivals + s.normal_arrivals;
+            segment->counters.urgent_arrivals += s.urgent_arrivals;
+            segment->counters.served += s.urgent_served + s.normal_served;
+            segment->counters.expired += s.urgent_expired + s.normal_expired;
+        }
+        for (size_t i = 0; i < day.history.size(); i++) {
+            segment->counters.waiting_time += day.history.at(i).wait();
+        }
+        segment->history = move(day.history);
+        segment->minute_log = move(day.minute_log);
+        return segment;
+    }
+
+    // Merge consecutive segments into a single segment
+    static shared_ptr<const ArchiveSegment> merge(const vector<shared_ptr<const ArchiveSegment>>& parts) {
+        auto merged = make_shared<ArchiveSegment>();
+        merged->first_day = parts.front()->first_day;
+        merged->last_day = parts.back()->last_day;
+        for (const auto& part : parts) {
+            for (size_t i = 0; i < part->history.size(); i++) {
+                merged->history.add(part->history.at(i));
+            }
+            merged->minute_log.insert(merged->minute_log.end(), part->minute_log.begin(), part->minute_log.end());
+            merged->counters.add(part->counters);
+        }
+        return merged;
+    }
+
+    // Find a run of single-day segments long enough to compact; returns its start or -1
+    int findCompactableRun() const {
+        int run_start = -1;
+        for (size_t i = 0; i < segments.size(); i++) {
+            if (segments[i]->first_day != segments[i]->last_day) {
+                run_start = -1;
+                continue;
+            }
+            if (run_start < 0) run_start = static_cast<int>(i);
+            // Keep the most recent day uncompacted so lookups of yesterday stay cheap
+            if (static_cast<int>(i) - run_start + 1 == days_per_compacted_segment && i + 1 < segments.size()) {
+                return run_start;
+            }
+        }
+        return -1;
+    }
+
+    void run() {
+#ifdef __linux__
+        // Lower this thread's priority so archiving never competes with the tick
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+#endif
+        MemScope scope(MemTag::Archive);
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            wake.wait(guard, [this] { return stopping || !pending.empty() || findCompactableRun() >= 0; });
+            if (!pending.empty()) {
+                PendingDay day = move(pending.front());
+                pending.erase(pending.begin());
+                guard.unlock();
+                auto segment = seal(day);
+                guard.lock();
+                segments.push_back(segment);
+                continue;
+            }
+            int start = findCompactableRun();
+            if (start >= 0) {
+                vector<shared_ptr<const ArchiveSegment>> parts(segments.begin() + start,
+                                                               segments.begin() + start + days_per_compacted_segment);
+                string prefix = spill_prefix;
+                guard.unlock();
+                auto merged = merge(parts);  // Readers keep using the old segments meanwhile
+                if (!prefix.empty()) merged = spill(merged, prefix);
+                guard.lock();
+                segments.erase(segments.begin() + start, segments.begin() + start + days_per_compacted_segment);
+                segments.insert(segments.begin() + start, merged);
+                guard.unlock();
+                parts.clear();  // Free the merged days outside the lock
+                this_thread::yield();
+                guard.lock();
+                continue;
+            }
+            if (stopping) break;
+        }
+    }
+
+public:
+    ArchiveStore() = default;
+    ArchiveStore(const ArchiveStore&) = delete;
+    ArchiveStore& operator=(const ArchiveStore&) = delete;
+
+    ~ArchiveStore() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (worker.joinable()) worker.join();
+        for (const string& path : spill_files) remove(path.c_str());
+    }
+
+    // Spill weekly segments to files whose names start with `prefix` (empty keeps everything in memory)
+    void setSpillPrefix(const string& prefix) {
+        lock_guard<mutex> guard(lock);
+        spill_prefix = prefix;
+    }
+
+    // The full segment: the segment itself, or for a spilled one a copy read back from its file
+    static shared_ptr<const ArchiveSegment> load(const shared_ptr<const ArchiveSegment>& segment) {
+        if (!segment->spilled()) return segment;
+        ifstream in(segment->spill_path, ios::binary);
+        ArchiveFileHeader header = {};
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!in || memcmp(header.magic, "ARCSEG1", 8) != 0) {
+            throw runtime_error("Cannot read archive file " + segment->spill_path + ".");
+        }
+        auto loaded = make_shared<ArchiveSegment>();
+        loaded->first_day = segment->first_day;
+        loaded->last_day = segment->last_day;
+        loaded->counters = segment->counters;
+        ServedRecord r;
+        for (uint64_t i = 0; i < header.record_count && in.read(reinterpret_cast<char*>(&r), sizeof(r)); i++) {
+            loaded->history.add(r);
+        }
+        loaded->minute_log.resize(header.snapshot_count);
+        in.read(reinterpret_cast<char*>(loaded->minute_log.data()),
+                static_cast<streamsize>(header.snapshot_count * sizeof(QueueSnapshot)));
+        if (!in) throw runtime_error("Archive file " + segment->spill_path + " is truncated.");
+        return loaded;
+    }
+
+    // Hand over a finished day; the containers are moved, not copied
+    void submit(int day, ServedHistory&& history, vector<QueueSnapshot>&& minute_log) {
+        {
+            lock_guard<mutex> guard(lock);
+            pending.push_back(PendingDay{day, move(history), move(minute_log)});
+            if (!worker.joinable()) worker = thread(&ArchiveStore::run, this);
+        }
+        wake.notify_one();
+    }
+
+    // Consistent view of the sealed segments, oldest first
+    vector<shared_ptr<const ArchiveSegment>> snapshot() const {
+        lock_guard<mutex> guard(lock);
+        return segments;
+    }
+
+    // Served records still held in memory: pending days plus sealed segments not spilled to disk
+    size_t residentRecords() const {
+        lock_guard<mutex> guard(lock);
+        size_t records = 0;
+        for (const PendingDay& day : pending) records += day.history.size();
+        for (const auto& segment : segments) {
+            if (!segment->spilled()) records += segment->history.size();
+        }
+        return records;
+    }
+
+    // Number of finished days not yet sealed into a segment
+    size_t pendingDays() const {
+        lock_guard<mutex> guard(lock);
+        return pending.size();
+    }
+};
+
+// HeatmapCell: Wait distribution and arrival counts for one weekday/hour cell
+struct HeatmapCell {
+    vector<long long> wait_counts;  // wait_counts[w] = patients served after waiting w whole seconds
+    long long served = 0;
+    long long arrivals = 0;
+    long long expirations = 0;
+
+    void addWait(SimTime wait) {
+        size_t w = wait < 0 ? 0 : static_cast<size_t>(wait / ms_per_second);
+        if (wait_counts.size() <= w) wait_counts.resize(w + 1);
+        wait_counts[w]++;
+        served++;
+    }
+
+    void merge(const HeatmapCell& other) {
+        if (wait_counts.size() < other.wait_counts.size()) wait_counts.resize(other.wait_counts.size());
+        for (size_t w = 0; w < other.wait_counts.size(); w++) wait_counts[w] += other.wait_counts[w];
+        served += other.served;
+        arrivals += other.arrivals;
+        expirations += other.expirations;
+    }
+
+    // Smallest wait w (seconds) such that at least fraction p of served patients waited <= w (-1 if none)
+    int percentile(double p) const {
+        if (served == 0) return -1;
+        long long needed = static_cast<long long>(p * served + 0.999999);
+        if (needed < 1) needed = 1;
+        long long seen = 0;
+        for (size_t w = 0; w < wait_counts.size(); w++) {
+            seen += wait_counts[w];
+            if (seen >= needed) return static_cast<int>(w);
+        }
+        return static_cast<int>(wait_counts.size()) - 1;
+    }
+};
+
+// WaitHeatmapReport Class: Hour-of-day x weekday heatmaps of waits, arrivals and expirations.
+// Waits are kept as small per-cell histograms, so a report is built in one
+// streaming pass: worker threads each fill a private heatmap from chunks of the
+// archived and live data, and the partial heatmaps are merged at the end.
+// Day 0 of the simulation is taken to be a Monday.
+class WaitHeatmapReport {
+    static const int days_per_week = 7;
+    static const int hours_per_day = 24;
+    HeatmapCell cells[days_per_week][hours_per_day];
+
+    static HeatmapCell& cellFor(HeatmapCell (&grid)[days_per_week][hours_per_day], int64_t minute) {
+        int64_t day = minute / (24 * 60);
+        return grid[day % days_per_week][minute / 60 % hours_per_day];
+    }
+
+    // A contiguous slice of either a served history or a minute log
+    struct Chunk {
+        const ServedHistory* history;
+        const vector<QueueSnapshot>* minute_log;
+        size_t begin, end;
+    };
+
+    void addChunk(const Chunk& chunk) {
+        for (size_t i = chunk.begin; i < chunk.end; i++) {
+            if (chunk.history) {
+                const ServedRecord& r = chunk.history->at(i);
+                cellFor(cells, r.servedMinute()).addWait(r.wait());
+            } else {
+                const QueueSnapshot& s = (*chunk.minute_log)[i];
+                HeatmapCell& cell = cellFor(cells, s.minute);
+                cell.arrivals += s.urgent_arrivals + s.normal_arrivals;
+                cell.expirations += s.urgent_expired + s.normal_expired;
+            }
+        }
+    }
+
+public:
+    void merge(const WaitHeatmapReport& other) {
+        for (int d = 0; d < days_per_week; d++)
+            for (int h = 0; h < hours_per_day; h++) cells[d][h].merge(other.cells[d][h]);
+    }
+
+    static const char* weekdayName(int day) {
+        static const char* names[] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
+        return names[day % days_per_week];
+    }
+
+    // Build the report over the archived segments and the live day using up to `threads` workers
+    static WaitHeatmapReport build(const vector<shared_ptr<const ArchiveSegment>>& segments,
+                                   const ServedHistory& live_history,
+                                   const vector<QueueSnapshot>& live_log,
+                                   unsigned threads) {
+        const size_t chunk_size = 1 << 16;
+        vector<Chunk> chunks;
+        auto split = [&](const ServedHistory* history, const vector<QueueSnapshot>* log, size_t count) {
+            for (size_t begin = 0; begin < count; begin += chunk_size) {
+                chunks.push_back(Chunk{history, log, begin, min(count, begin + chunk_size)});
+            }
+        };
+        for (const auto& segment : segments) {
+            split(&segment->history, nullptr, segment->history.size());
+            split(nullptr, &segment->minute_log, segment->minute_log.size());
+        }
+        split(&live_history, nullptr, live_history.size());
+        split(nullptr, &live_log, live_log.size());
+
+        if (threads == 0) threads = 1;
+        threads = static_cast<unsigned>(min<size_t>(threads, max<size_t>(chunks.size(), 1)));
+        vector<WaitHeatmapReport> partial(threads);
+        atomic<size_t> next_chunk(0);
+        auto work = [&](unsigned worker) {
+            for (size_t c = next_chunk++; c < chunks.size(); c = next_chunk++) {
+                partial[worker].addChunk(chunks[c]);
+            }
+        };
+        vector<thread> workers;
+        for (unsigned t = 1; t < threads; t++) workers.emplace_back(work, t);
+        work(0);
+        for (auto& w : workers) w.join();
+
+        for (unsigned t = 1; t < threads; t++) partial[0].merge(partial[t]);
+        return move(partial[0]);
+    }
+
+    // One row per weekday/hour cell
+    void writeCsv(ostream& out) const {
+        out << "weekday,hour,served,median_wait_s,p95_wait_s,arrivals,expirations\n";
+        for (int d = 0; d < days_per_week; d++) {
+            for (int h = 0; h < hours_per_day; h++) {
+                const HeatmapCell& c = cells[d][h];
+                out << weekdayName(d) << "," << h << "," << c.served << ","
+                    << c.percentile(0.5) << "," << c.percentile(0.95) << ","
+                    << c.arrivals << "," << c.expirations << "\n";
+            }
+        }
+    }
+
+    // Four weekday x hour tables: median wait, p95 wait, arrivals and expirations
+    void writeText(ostream& out) const {
+        const char* titles[] = {"Median wait (min)", "P95 wait (min)", "Arrivals", "Expirations"};
+        for (int table = 0; table < 4; table++) {
+            out << "\n" << titles[table] << ":\n    ";
+            for (int h = 0; h < hours_per_day; h++) out << setw(5) << h;
+            out << "\n";
+            for (int d = 0; d < days_per_week; d++) {
+                out << weekdayName(d) << " ";
+                for (int h = 0; h < hours_per_day; h++) {
+                    const HeatmapCell& c = cells[d][h];
+                    if (table < 2) {
+                        int seconds = c.percentile(table == 0 ? 0.5 : 0.95);
+                        if (seconds < 0) out << setw(5) << "-";
+                        else out << setw(5) << fixed << setprecision(1) << seconds / 60.0;
+                    } else {
+                        out << setw(5) << (table == 2 ? c.arrivals : c.expirations);
+                    }
+                }
+                out << "\n";
+            }
+        }
+    }
+};
+
+// BedAllocator Class: Assigns ward beds to admitted patients in bays of their own gender.
+// Each bay keeps a bitset of free beds plus a summary bitset of the words that
+// still have a free bed, and each gender keeps a bitset of bays with room, so
+// allocation is a few find-first-set steps and release is a single bit set.
+// Patients who find no bed wait in a per-gender FIFO until one is released.
+// Discharge times are not tracked here: the caller schedules a timer for
+// each bed it is given and calls discharge() when the stay ends.
+class BedAllocator {
+    struct Bay {
+        char gender;                   // 'M' or 'F'
+        int first_bed;                 // Bed number of the bay's first bed
+        int size;                      // Number of beds in the bay
+        int free_count;                // Beds currently free
+        vector<uint64_t> free_bits;    // Bit set = bed free
+        vector<uint64_t> summary;      // Bit w set = free_bits[w] has a free bed
+    };
+
+    struct WaitingPatient {
+        string id;          // Patient ID
+        int since_minute;   // Minute the patient finished service and started waiting
+        int stay;           // Minutes the patient will occupy a bed
+    };
+
+    vector<Bay> bays;
+    vector<int> bay_of_bed;                     // Bed number -> bay index
+    vector<uint64_t> bays_with_room[2];         // Per gender: bit b set = bay b has a free bed
+    queue<WaitingPatient> waiting[2];           // Per gender: patients blocked for lack of a bed
+    int total_beds[2] = {0, 0};
+    int occupied[2] = {0, 0};
+    long long admitted = 0;                     // Patients given a bed
+    long long ever_blocked = 0;                 // Patients who had to wait for a bed
+    long long blocked_minutes = 0;              // Total minutes spent waiting for a bed
+
+    static int slot(char gender) { return (gender == 'F' || gender == 'f') ? 1 : 0; }
+
+    static void setBit(vector<uint64_t>& bits, size_t i) { bits[i / 64] |= uint64_t(1) << (i % 64); }
+    static void clearBit(vector<uint64_t>& bits, size_t i) { bits[i / 64] &= ~(uint64_t(1) << (i % 64)); }
+
+    // Index of the first set bit in a bitset, or -1 if none is set
+    static int findFirstSet(const vector<uint64_t>& bits) {
+        for (size_t w = 0; w < bits.size(); w++) {
+            if (bits[w]) return static_cast<int>(w * 64 + lowestSetBit(bits[w]));
+        }
+        return -1;
+    }
+
+    // Take a free bed for the given gender; returns the bed number or -1 if the bays are full
+    int allocate(int g) {
+        int b = findFirstSet(bays_with_room[g]);
+        if (b < 0) return -1;
+        Bay& bay = bays[b];
+        int w = findFirstSet(bay.summary);        // First word with a free bed
+        int bit = lowestSetBit(bay.free_bits[w]);
+        int index = w * 64 + bit;
+        bay.free_bits[w] &= bay.free_bits[w] - 1;  // Clear the lowest set bit
+        if (bay.free_bits[w] == 0) clearBit(bay.summary, w);
+        if (--bay.free_count == 0) clearBit(bays_with_room[g], b);
+        occupied[g]++;
+        return bay.first_bed + index;
+    }
+
+public:
+    // Give a bed back to its bay in O(1) when the patient in it is discharged
+    void discharge(int bed) {
+        int b = bay_of_bed[bed];
+        Bay& bay = bays[b];
+        int index = bed - bay.first_bed;
+        setBit(bay.free_bits, index);
+        setBit(bay.summary, index / 64);
+        if (bay.free_count++ == 0) setBit(bays_with_room[slot(bay.gender)], b);
+        occupied[slot(bay.gender)]--;
+    }
+
+    // Add a bay of `size` beds for patients of the given gender
+    void addBay(char gender, int size) {
+        Bay bay;
+        bay.gender = static_cast<char>(toupper(gender));
+        bay.first_bed = static_cast<int>(bay_of_bed.size());
+        bay.size = size;
+        bay.free_count = size;
+        bay.free_bits.assign((size + 63) / 64, 0);
+        bay.summary.assign((bay.free_bits.size() + 63) / 64, 0);
+        for (int i = 0; i < size; i++) setBit(bay.free_bits, i);
+        for (size_t w = 0; w < bay.free_bits.size(); w++) setBit(bay.summary, w);
+
+        int b = static_cast<int>(bays.size());
+        int g = slot(bay.gender);
+        for (auto& bits : bays_with_room) bits.resize(b / 64 + 1, 0);
+        if (size > 0) setBit(bays_with_room[g], b);
+        bay_of_bed.insert(bay_of_bed.end(), size, b);
+        total_beds[g] += size;
+        bays.push_back(move(bay));
+    }
+
+    bool hasBeds() const { return !bays.empty(); }
+
+    // A patient finished service and needs a bed for `stay` minutes; returns the bed, or -1 if they must wait
+    int admit(const string& id, char gender, int minute, int stay) {
+        int g = slot(gender);
+        if (waiting[g].empty()) {
+            int bed = allocate(g);
+            if (bed >= 0) {
+                admitted++;
+                return bed;
+            }
+        }
+        waiting[g].push({id, minute, stay});  // Blocked: wait behind earlier patients
+        ever_blocked++;
+        return -1;
+    }
+
+    // Move blocked patients into free beds; returns (bed, stay) for each patient placed
+    vector<pair<int, int>> placeWaiting(int minute) {
+        vector<pair<int, int>> placed;
+        for (int g = 0; g < 2; g++) {
+            while (!waiting[g].empty()) {
+                int bed = allocate(g);
+                if (bed < 0) break;
+                WaitingPatient& w = waiting[g].front();
+                blocked_minutes += minute - w.since_minute;
+                placed.push_back({bed, w.stay});
+                admitted++;
+                waiting[g].pop();
+            }
+        }
+        return placed;
+    }
+
+    // Print occupancy and blocking figures
+    void displayStatistics() const {
+        if (bays.empty()) return;
+        cout << "\nWard Beds:\n";
+        const char* names[] = {"Male", "Female"};
+        for (int g = 0; g < 2; g++) {
+            cout << names[g] << " bays: " << occupied[g] << "/" << total_beds[g] << " occupied";
+            if (total_beds[g] > 0) {
+                cout << " (" << fixed << setprecision(1) << 100.0 * occupied[g] / total_beds[g] << "%)";
+            }
+            cout << ", " << waiting[g].size() << " waiting for a bed\n";
+        }
+        cout << "Admitted: " << admitted << ", blocked after service: " << ever_blocked;
+        long long placed_after_block = ever_blocked - static_cast<long long>(waiting[0].size() + waiting[1].size());
+        if (placed_after_block > 0) {
+            cout << ", average block " << fixed << setprecision(2)
+                 << static_cast<double>(blocked_minutes) / placed_after_block << " minutes";
+        }
+        cout << endl;
+    }
+};
+
+// AppointmentCalendar Class: Pre-booked appointments, one per minute slot.
+// Bookings are kept in a map ordered by slot, so booking, cancelling and
+// taking a due appointment are O(log n) and never scan the calendar. The
+// scheduler sets a timer for each booking to know when to take it. Booked
+// minutes form a 64-ary tree of bitmaps: level 0 has a bit per minute and
+// each level above has a bit per fully booked word of the level below, so
+// "next free slot" climbs and descends at most one word per level, O(log64 n).
+class AppointmentCalendar {
+    map<int, Patient> by_slot;              // Slot minute -> booked patient
+    unordered_map<string, int> slot_of;     // Patient ID -> slot minute
+    vector<vector<uint64_t>> levels;        // levels[0] bit m = minute m booked; levels[k + 1] bit w = levels[k][w] full
+
+    void mark(int minute, bool taken) {
+        if (levels.empty()) levels.emplace_back();
+        size_t w = minute / 64;
+        if (levels[0].size() <= w) {
+            // Grow every level, adding levels until the top one fits in a single word
+            levels[0].resize(w + 1, 0);
+            for (size_t k = 0; levels[k].size() > 1; k++) {
+                if (k + 1 == levels.size()) levels.emplace_back();
+                levels[k + 1].resize((levels[k].size() + 63) / 64, 0);
+            }
+        }
+        size_t i = minute;
+        for (size_t k = 0; k < levels.size(); k++) {
+            uint64_t& word = levels[k][i / 64];
+            bool was_full = word == ~uint64_t(0);
+            uint64_t bit = uint64_t(1) << (i % 64);
+            if (taken) word |= bit;
+            else word &= ~bit;
+            if ((word == ~uint64_t(0)) == was_full) break;  // Levels above are unchanged
+            taken = !was_full;
+            i /= 64;
+        }
+    }
+
+public:
+    bool isBooked(int minute) const {
+        size_t w = minute / 64;
+        return !levels.empty() && w < levels[0].size() && (levels[0][w] >> (minute % 64) & 1);
+    }
+
+    // First unbooked minute at or after `from`
+    int nextFreeSlot(int from) const {
+        // Climb until a word has a clear bit at or after the position; past the end of a level is free
+        size_t k = 0, i = from;
+        for (; k < levels.size(); k++) {
+            size_t w = i / 64;
+            if (w >= levels[k].size()) break;
+            uint64_t clear = ~levels[k][w] & (~uint64_t(0) << (i % 64));
+            if (clear) {
+                i = w * 64 + lowestSetBit(clear);
+                break;
+            }
+            i = w + 1;  // The rest of this word is full; continue from the next word, one level up
+        }
+        // Descend into the not-full word below, taking its first clear bit
+        for (; k > 0; k--) {
+            if (i >= levels[k - 1].size()) return static_cast<int>(i << (6 * k));
+            i = i * 64 + lowestSetBit(~levels[k - 1][i]);
+        }
+        return static_cast<int>(i);
+    }
+
+    // Book a patient into a free slot
+    void book(const Patient& patient, int minute) {
+        if (minute < 0) throw invalid_argument("Appointment time cannot be negative.");
+        if (isBooked(minute)) throw invalid_argument("Slot " + to_string(minute) + " is already booked.");
+        if (slot_of.count(patient.getId())) throw invalid_argument("Patient " + patient.getId() + " already has an appointment.");
+        by_slot.emplace(minute, patient);
+        slot_of[patient.getId()] = minute;
+        mark(minute, true);
+    }
+
+    // Cancel a patient's appointment; returns false if they had none
+    bool cancel(const string& id) {
+        auto it = slot_of.find(id);
+        if (it == slot_of.end()) return false;
+        by_slot.erase(it->second);
+        mark(it->second, false);
+        slot_of.erase(it);
+        return true;
+    }
+
+    // Slot booked by a patient, or -1 if they have no appointment
+    int slotOf(const string& id) const {
+        auto it = slot_of.find(id);
+        return it == slot_of.end() ? -1 : it->second;
+    }
+
+    // Remove and return the appointment booked in a slot (which must be booked)
+    Patient take(int minute) {
+        auto it = by_slot.find(minute);
+        Patient patient = it->second;
+        slot_of.erase(patient.getId());
+        mark(minute, false);
+        by_slot.erase(it);
+        return patient;
+    }
+
+    size_t size() const { return by_slot.size(); }
+};
+
+// Skills a patient can require and a clinician can offer, one bit each in a 32-bit mask
+const int max_skills = 32;
+const char* const skill_names[] = {"pediatrics", "cardiology", "female", "orthopedics", "neurology", "psychiatry", "obstetrics", "trauma"};
+const int named_skills = sizeof(skill_names) / sizeof(skill_names[0]);
+
+// Parse a comma-separated skill list such as "pediatrics,female" into a mask
+uint32_t parseSkills(const string& list) {
+    uint32_t mask = 0;
+    stringstream ss(list);
+    string name;
+    while (getline(ss, name, ',')) {
+        for (char& c : name) c = static_cast<char>(tolower(c));
+        int skill = find(skill_names, skill_names + named_skills, name) - skill_names;
+        if (skill == named_skills) throw invalid_argument("Unknown skill '" + name + "'.");
+        mask |= uint32_t(1) << skill;
+    }
+    return mask;
+}
+
+// Format a skill mask as a comma-separated list, "-" when empty
+string formatSkills(uint32_t mask) {
+    string list;
+    for (int skill = 0; skill < max_skills; skill++) {
+        if (!(mask >> skill & 1)) continue;
+        if (!list.empty()) list += ",";
+        list += skill < named_skills ? skill_names[skill] : "skill" + to_string(skill);
+    }
+    return list.empty() ? "-" : list;
+}
+
+// ClinicianPool Class: The clinicians on shift and which of them are free this tick.
+// Besides one bitset of free clinicians there is one per skill, holding only the free
+// clinicians who have that skill. A patient's match is the AND of the bitsets for the
+// skills they need, and the lowest set bit picks the clinician, 64 clinicians at a time.
+class ClinicianPool {
+    vector<string> names;
+    vector<uint32_t> skills;                 // Skill mask per clinician
+    vector<uint64_t> free_all;               // Bit c set = clinician c is free
+    vector<uint64_t> free_with[max_skills];  // Bit c set = clinician c is free and has the skill
+    size_t free_count = 0;
+    long long assigned = 0;                  // Patients matched to a clinician
+    long long unmatched = 0;                 // Attempts that found no free clinician with the skills
+
+    void setFree(int c, bool free) {
+        uint64_t bit = uint64_t(1) << (c % 64);
+        size_t w = c / 64;
+        if (((free_all[w] & bit) != 0) == free) return;
+        if (free) free_all[w] |= bit;
+        else free_all[w] &= ~bit;
+        free_count += free ? 1 : -1;
+        for (uint32_t mask = skills[c]; mask; mask &= mask - 1) {
+            int skill = lowestSetBit(mask);
+            if (free) free_with[skill][w] |= bit;
+            else free_with[skill][w] &= ~bit;
+        }
+    }
+
+public:
+    static const int no_match = -1;
+
+    // Add a clinician with the given skills; returns their number
+    int addClinician(const string& name, uint32_t skill_mask) {
+        int c = static_cast<int>(names.size());
+        names.push_back(name);
+        skills.push_back(skill_mask);
+        if (free_all.size() * 64 <= static_cast<size_t>(c)) {
+            free_all.push_back(0);
+            for (auto& bits : free_with) bits.push_back(0);
+        }
+        setFree(c, true);
+        return c;
+    }
+
+    // Take the first free clinician who has every skill in `required`, or return no_match
+    int assign(uint32_t required) {
+        for (size_t w = 0; w < free_all.size(); w++) {
+            uint64_t candidates = free_all[w];
+            for (uint32_t mask = required; mask && candidates; mask &= mask - 1) {
+                candidates &= free_with[lowestSetBit(mask)][w];
+            }
+            if (candidates) {
+                int c = static_cast<int>(w * 64 + lowestSetBit(candidates));
+                setFree(c, false);
+                assigned++;
+                return c;
+            }
+        }
+        unmatched++;
+        return no_match;
+    }
+
+    // Free every clinician; each sees at most one patient per tick
+    void releaseAll() {
+        for (size_t c = 0; c < names.size(); c++) setFree(static_cast<int>(c), true);
+    }
+
+    size_t size() const { return names.size(); }
+    size_t freeCount() const { return free_count; }
+    const string& name(int c) const { return names[c]; }
+
+    // Display the roster size, free clinicians per skill and matching totals
+    void displayStatistics() const {
+        if (names.empty()) return;
+        cout << "Clinicians: " << free_count << "/" << names.size() << " free, "
+             << assigned << " patients matched, " << unmatched << " held back for a skill match\n";
+        for (int skill = 0; skill < max_skills; skill++) {
+            long long have = 0, free = 0;
+            for (uint32_t mask : skills) have += mask >> skill & 1;
+            if (have == 0) continue;
+            for (uint64_t word : free_with[skill]) free += bitset<64>(word).count();
+            cout << "  " << left << setw(12) << formatSkills(uint32_t(1) << skill) << right
+                 << free << "/" << have << " free\n";
+        }
+    }
+};
+
+// PerfProfiler Class: Optional hardware counters (cycles, instructions, cache and
+// branch misses) read around addPatient, servePatients and the per-minute tick.
+// Counters come from perf_event_open as one group so they are read together;
+// when the kernel refuses access or the platform has no PMU, start() reports
+// why and every PerfScope becomes a no-op. A group counts only the thread that
+// opened it, so each thread opens its own on first use and keeps its own region
+// totals; report() adds up the totals of every thread that was profiled.
+enum class PerfRegion { AddPatient, ServePatients, Tick, Count };
+
+// PerfRegionStats: Counter totals for one profiled region
+struct PerfRegionStats {
+    long long calls = 0;
+    long long patients = 0;            // Patients handled inside the region
+    long long counts[4] = {0, 0, 0, 0};  // cycles, instructions, cache misses, branch misses
+};
+
+// PerfThreadGroup: One thread's counter group and region totals
+struct PerfThreadGroup {
+    int fds[4] = {-1, -1, -1, -1};
+    int slot_of_counter[4] = {-1, -1, -1, -1};  // Position in the group read, -1 if unsupported
+    PerfRegionStats* regions = nullptr;         // Owned by the profiler, so the totals outlive the thread
+    bool tried = false;
+
+    ~PerfThreadGroup() {
+#ifdef __linux__
+        for (int fd : fds) {
+            if (fd >= 0) close(fd);
+        }
+#endif
+    }
+    bool open() const { return regions != nullptr; }
+};
+
+class PerfProfiler {
+public:
+    static const int counter_count = 4;
+
+    static inline bool active = false;
+
+private:
+    static inline mutex registry_lock;                             // Guards the two fields below
+    static inline vector<unique_ptr<PerfRegionStats[]>> registry;  // Region totals of every profiled thread
+    static inline bool missing_counters = false;                   // Some counter was unsupported
+    static inline thread_local PerfThreadGroup group;
+
+    // Open the calling thread's group; returns false with the reason in `error` if counters are unavailable
+    static bool openGroup(PerfThreadGroup& g, string& error) {
+#ifdef __linux__
+        const uint64_t configs[counter_count] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                 PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        int opened = 0;
+        for (int c = 0; c < counter_count; c++) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = configs[c];
+            attr.disabled = g.fds[0] < 0 ? 1 : 0;  // Only the leader starts disabled
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, g.fds[0], 0));
+            if (fd < 0) {
+                if (g.fds[0] < 0 && c == 0) {
+                    error = strerror(errno);
+                    return false;
+                }
+                continue;  // This counter is not supported here; keep the others
+            }
+            g.fds[opened] = fd;
+            g.slot_of_counter[c] = opened++;
+        }
+        ioctl(g.fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(g.fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+        lock_guard<mutex> guard(registry_lock);
+        registry.emplace_back(new PerfRegionStats[static_cast<int>(PerfRegion::Count)]);
+        g.regions = registry.back().get();
+        missing_counters = missing_counters || opened < counter_count;
+        return true;
+#else
+        (void)g;
+        error = "only supported on Linux";
+        return false;
+#endif
+    }
+
+public:
+    // Open the main thread's counter group; returns false (with a message) if counters are unavailable
+    static bool start(ostream& out) {
+        group.tried = true;
+        string error;
+        if (!openGroup(group, error)) {
+            out << "Hardware counters unavailable (" << error << "); profiling disabled.\n";
+            return false;
+        }
+        active = true;
+        return true;
+    }
+
+    // The calling thread's group, opened on its first profiled region (check open() before reading)
+    static PerfThreadGroup& thisThread() {
+        if (!group.tried) {
+            group.tried = true;
+            string error;
+            openGroup(group, error);  // A thread that cannot open its group simply goes unprofiled
+        }
+        return group;
+    }
+
+    // Current value of every counter in a thread's group (0 for unsupported ones)
+    static void read(const PerfThreadGroup& g, long long values[counter_count]) {
+        for (int c = 0; c < counter_count; c++) values[c] = 0;
+#ifdef __linux__
+        uint64_t buffer[1 + counter_count];
+        if (::read(g.fds[0], buffer, sizeof(buffer)) < static_cast<ssize_t>(sizeof(uint64_t))) return;
+        for (int c = 0; c < counter_count; c++) {
+            if (g.slot_of_counter[c] >= 0) values[c] = static_cast<long long>(buffer[1 + g.slot_of_counter[c]]);
+        }
+#endif
+    }
+
+    // Print IPC and misses per patient for each region, summed over every profiled thread.
+    // Call once the profiled threads have finished.
+    static void report(ostream& out) {
+        if (!active) return;
+        PerfRegionStats totals[static_cast<int>(PerfRegion::Count)];
+        lock_guard<mutex> guard(registry_lock);
+        for (const auto& regions : registry) {
+            for (int r = 0; r < static_cast<int>(PerfRegion::Count); r++) {
+                totals[r].calls += regions[r].calls;
+                totals[r].patients += regions[r].patients;
+                for (int c = 0; c < counter_count; c++) totals[r].counts[c] += regions[r].counts[c];
+            }
+        }
+        const char* names[] = {"addPatient", "servePatients", "tick"};
+        out << "\nHardware Counters (" << registry.size() << " thread(s)):\n";
+        out << "Region           Calls   Patients       IPC  Cycles/pt  CacheMiss/pt  BranchMiss/pt\n";
+        for (int r = 0; r < static_cast<int>(PerfRegion::Count); r++) {
+            const PerfRegionStats& s = totals[r];
+            if (s.calls == 0) continue;
+            double per = s.patients > 0 ? static_cast<double>(s.patients) : 1.0;
+            out << left << setw(15) << names[r] << right << setw(7) << s.calls << setw(11) << s.patients
+                << fixed << setprecision(2)
+                << setw(10) << (s.counts[0] > 0 ? static_cast<double>(s.counts[1]) / s.counts[0] : 0.0)
+                << setw(11) << s.counts[0] / per
+                << setw(14) << s.counts[2] / per
+                << setw(15) << s.counts[3] / per << "\n";
+        }
+        if (missing_counters) {
+            out << "(some counters are not supported on this machine and read as 0)\n";
+        }
+    }
+};
+
+// PerfScope: Adds the counter deltas over its lifetime to one region of the calling thread
+class PerfScope {
+    PerfRegion region;
+    const PerfThreadGroup* group = nullptr;
+    long long start[PerfProfiler::counter_count];
+    long long patients = 1;
+public:
+    explicit PerfScope(PerfRegion region) : region(region) {
+        if (!PerfProfiler::active) return;
+        const PerfThreadGroup& g = PerfProfiler::thisThread();
+        if (!g.open()) return;
+        group = &g;
+        PerfProfiler::read(g, start);
+    }
+    void setPatients(long long count) { patients = count; }
+    ~PerfScope() {
+        if (!group) return;
+        long long end[PerfProfiler::counter_count];
+        PerfProfiler::read(*group, end);
+        PerfRegionStats& s = group->regions[static_cast<int>(region)];
+        s.calls++;
+        s.patients += patients;
+        for (int c = 0; c < PerfProfiler::counter_count; c++) s.counts[c] += end[c] - start[c];
+    }
+};
+
+// SamplingProfiler Class: Built-in statistical profiler for long batch runs.
+// A SIGPROF interval timer interrupts the process (200 times per CPU second by
+// default); the handler captures the stack with backtrace() into a
+// preallocated sample buffer, claiming a slot with one atomic increment, so it
+// never locks or allocates. At the end the samples are symbolized and written
+// as collapsed stacks ("main;Scheduler::servePatients;... count") for flame
+// graph tools. Link with -rdynamic to get names for functions that are not
+// exported; otherwise they appear as addresses.
+class SamplingProfiler {
+    static constexpr int max_depth = 32;            // Frames kept per sample
+    static constexpr size_t max_samples = 1 << 17;  // About 11 CPU minutes at 200 Hz; later samples are dropped
+
+    struct Sample {
+        int depth;
+        void* frames[max_depth];
+    };
+
+    static inline Sample* samples = nullptr;
+    static inline atomic<size_t> next_sample{0};
+    static inline atomic<size_t> dropped{0};
+    static inline bool running = false;
+
+#ifdef __linux__
+    static void onSignal(int) {
+        size_t slot = next_sample.fetch_add(1, memory_order_relaxed);
+        if (slot >= max_samples) {
+            dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        samples[slot].depth = backtrace(samples[slot].frames, max_depth);
+    }
+
+    // Human-readable name for a code address
+    static string symbolName(void* address) {
+        Dl_info info;
+        if (dladdr(address, &info) && info.dli_sname) {
+            int status = 0;
+            char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            string name = (status == 0 && demangled) ? demangled : info.dli_sname;
+            free(demangled);
+            // Drop the parameter list; flame graphs group by function
+            size_t paren = name.find('(');
+            if (paren != string::npos && paren > 0) name.erase(paren);
+            return name;
+        }
+        ostringstream out;
+        out << address;
+        return out.str();
+    }
+#endif
+
+public:
+    // Start sampling at `hz` samples per CPU second; returns false if unsupported
+    static bool start(ostream& out, int hz = 200) {
+#ifdef __linux__
+        if (running) {
+            out << "The sampling profiler is already running.\n";
+            return false;
+        }
+        void* warm_up[1];
+        backtrace(warm_up, 1);  // The first call may allocate, so make it outside the handler
+
+        // The buffer must exist before the first signal can arrive; it is freed again if setup fails
+        samples = new Sample[max_samples];
+        next_sample = 0;
+        dropped = 0;
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = onSignal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGPROF, &action, nullptr) != 0) {
+            out << "Sampling profiler unavailable (" << strerror(errno) << ").\n";
+            delete[] samples;
+            samples = nullptr;
+            return false;
+        }
+        itimerval timer;
+        timer.it_interval.tv_sec = 0;
+        timer.it_interval.tv_usec = 1000000 / hz;
+        timer.it_value = timer.it_interval;
+        if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+            out << "Sampling profiler unavailable (" << strerror(errno) << ").\n";
+            signal(SIGPROF, SIG_IGN);
+            delete[] samples;
+            samples = nullptr;
+            return false;
+        }
+        running = true;
+        return true;
+#else
+        (void)hz;
+        out << "The sampling profiler is only supported on Linux.\n";
+        return false;
+#endif
+    }
+
+    static bool isRunning() { return running; }
+
+    // Stop sampling and write collapsed stacks to `path`
+    static void stopAndWrite(const string& path, ostream& out) {
+#ifdef __linux__
+        if (!running) return;
+        itimerval off = {};
+        setitimer(ITIMER_PROF, &off, nullptr);
+        signal(SIGPROF, SIG_IGN);
+        running = false;
+
+        size_t count = min(next_sample.load(), max_samples);
+        map<string, long long> stacks;           // Collapsed stack -> samples
+        unordered_map<void*, string> names;      // Symbol cache
+        const int skipped = 2;                   // The handler and the signal trampoline
+        for (size_t i = 0; i < count; i++) {
+            string stack;
+            for (int f = samples[i].depth - 1; f >= skipped; f--) {  // Root first
+                void* address = samples[i].frames[f];
+                auto it = names.find(address);
+                if (it == names.end()) it = names.emplace(address, symbolName(address)).first;
+                if (!stack.empty()) stack += ';';
+                stack += it->second;
+            }
+            if (!stack.empty()) stacks[stack]++;
+        }
+
+        ofstream file(path);
+        if (!file) {
+            out << "Could not write profile to " << path << "\n";
+        } else {
+            for (const auto& entry : stacks) file << entry.first << " " << entry.second << "\n";
+            out << "Profile: " << count << " samples (" << dropped.load() << " dropped) written to " << path << "\n";
+        }
+        delete[] samples;
+        samples = nullptr;
+#else
+        (void)path;
+        (void)out;
+#endif
+    }
+};
+
+// TimingWheel Class: Hierarchical timing wheel, the scheduler's single timer facility.
+// Times are in scheduler ticks. Four levels of 64 slots cover 64^4 (about 16.8
+// million) ticks ahead: about 32 years at the default one-minute tick, 194 days
+// at one second and 4.7 hours at --tick-ms 1, with later timers parked on an
+// overflow list until they come in range. A timer sits in the level matching
+// how far off it is and drops to finer levels as time approaches, so insert,
+// cancel and expire are O(1) and each tick only touches the slots whose time
+// has come. Timers are pooled nodes in intrusive doubly linked lists and carry
+// a small (kind, arg) payload instead of a closure, so millions of outstanding
+// timers cost no allocations.
+class TimingWheel {
+public:
+    typedef uint64_t TimerId;                   // Index plus generation; stale ids are ignored
+    static const TimerId no_timer = ~TimerId(0);
+
+private:
+    static const int levels = 4;
+    static const int slot_bits = 6;
+    static const int slots = 1 << slot_bits;
+    static const int overflow_list = levels * slots;  // Timers beyond the top level
+    static const int ready_list = overflow_list + 1;  // Timers due now, waiting to fire
+
+    struct Node {
+        int64_t due;
+        uint32_t kind;
+        uint64_t arg;
+        int32_t prev, next;
+        int32_t list;          // List the node is linked into, -1 if free
+        uint32_t generation;   // Bumped on reuse so old ids cannot cancel a new timer
+    };
+
+    vector<Node> nodes;
+    vector<int32_t> heads = vector<int32_t>(ready_list + 1, -1);
+    int32_t free_head = -1;
+    int64_t now = 0;
+    size_t active = 0;
+
+    void link(int32_t n, int32_t list) {
+        Node& node = nodes[n];
+        node.list = list;
+        node.prev = -1;
+        node.next = heads[list];
+        if (node.next >= 0) nodes[node.next].prev = n;
+        heads[list] = n;
+    }
+
+    void unlink(int32_t n) {
+        Node& node = nodes[n];
+        if (node.prev >= 0) nodes[node.prev].next = node.next;
+        else heads[node.list] = node.next;
+        if (node.next >= 0) nodes[node.next].prev = node.prev;
+        node.list = -1;
+    }
+
+    // Pick the list for a timer: the level of the highest 6-bit group in which due and now differ
+    int listFor(int64_t due) const {
+        if (due <= now) return ready_list;
+        uint64_t diff = static_cast<uint64_t>(due) ^ static_cast<uint64_t>(now);
+        for (int level = 0; level < levels; level++) {
+            if ((diff >> (slot_bits * (level + 1))) == 0) {
+                return level * slots + static_cast<int>((due >> (slot_bits * level)) & (slots - 1));
+            }
+        }
+        return overflow_list;
+    }
+
+    // Re-file every timer of a list according to the current time
+    void cascade(int list) {
+        int32_t n = heads[list];
+        heads[list] = -1;
+        while (n >= 0) {
+            int32_t next = nodes[n].next;
+            link(n, listFor(nodes[n].due));
+            n = next;
+        }
+    }
+
+public:
+    explicit TimingWheel(int64_t start = 0) : now(start) {}
+
+    // Run `kind`/`arg` at time `due` (at the next advance if due is not in the future)
+    TimerId schedule(int64_t due, uint32_t kind, uint64_t arg) {
+        int32_t n;
+        if (free_head >= 0) {
+            n = free_head;
+            free_head = nodes[n].next;
+        } else {
+            n = static_cast<int32_t>(nodes.size());
+            nodes.push_back(Node{0, 0, 0, -1, -1, -1, 0});
+        }
+        nodes[n].due = due;
+        nodes[n].kind = kind;
+        nodes[n].arg = arg;
+        link(n, listFor(due));
+        active++;
+        return (static_cast<TimerId>(nodes[n].generation) << 32) | static_cast<uint32_t>(n);
+    }
+
+    // Cancel a pending timer; returns false if it already fired or was cancelled
+    bool cancel(TimerId id) {
+        if (id == no_timer) return false;
+        int32_t n = static_cast<int32_t>(id & 0xFFFFFFFFu);
+        if (n >= static_cast<int32_t>(nodes.size())) return false;
+        Node& node = nodes[n];
+        if (node.list < 0 || node.generation != static_cast<uint32_t>(id >> 32)) return false;
+        unlink(n);
+        node.generation++;
+        node.next = free_head;
+        free_head = n;
+        active--;
+        return true;
+    }
+
+    // Move time forward to `to`, calling fire(kind, arg) for every timer due by then.
+    // Callbacks may schedule or cancel timers; ones due by `to` fire in this call.
+    template <class Fire>
+    void advance(int64_t to, Fire&& fire) {
+        while (now < to) {
+            if (active == 0) {
+                now = to;  // Nothing pending: jump straight there
+                break;
+            }
+            now++;
+            // Cascade from the coarsest level whose slot boundary was just crossed
+            int top = 0;
+            while (top + 1 < levels && (now & ((int64_t(1) << (slot_bits * (top + 1))) - 1)) == 0) top++;
+            if (top == levels - 1 && (now & ((int64_t(1) << (slot_bits * levels)) - 1)) == 0) cascade(overflow_list);
+            for (int level = top; level >= 1; level--) {
+                cascade(level * slots + static_cast<int>((now >> (slot_bits * level)) & (slots - 1)));
+            }
+            cascade(static_cast<int>(now & (slots - 1)));  // Level-0 slot for this minute moves to ready
+        }
+        while (heads[ready_list] >= 0) {
+            int32_t n = heads[ready_list];
+            uint32_t kind = nodes[n].kind;
+            uint64_t arg = nodes[n].arg;
+            cancel((static_cast<TimerId>(nodes[n].generation) << 32) | static_cast<uint32_t>(n));
+            fire(kind, arg);
+        }
+    }
+
+    int64_t currentTime() const { return now; }
+    size_t pending() const { return active; }
+};
+
+// AdmissionController Class: Load shedding for normal patients during surges.
+// The wait a new patient can expect is estimated in O(1) as the patients ahead of
+// them divided by an exponentially weighted service rate. Above the threshold a
+// normal patient is either deferred (asked to come back and offered again later)
+// or redirected elsewhere; urgent patients are always admitted, which keeps their
+// waits bounded because the normal queue stops growing behind them.
+enum class AdmissionMode { Off, Defer, Redirect };
+
+class AdmissionController {
+public:
+    enum Decision { Admit, Defer, Redirect };
+    static const int defer_minutes = 5;     // Time before a deferred patient is offered again
+    static const int max_defers = 3;        // Offers before a deferred patient is redirected after all
+
+private:
+    AdmissionMode mode = AdmissionMode::Off;
+    double threshold_minutes;
+    double rate;                             // Patients served per minute, smoothed
+    double alpha_per_minute = 0.2;           // Weight of a one-minute sample in the average
+    long long counts[3] = {0, 0, 0};         // By decision
+    long long readmitted = 0;                // Deferred patients admitted on a later offer
+    double worst_estimate = 0;               // Highest estimate seen for a normal patient
+
+public:
+    AdmissionController(double threshold_minutes, double initial_rate)
+        : threshold_minutes(threshold_minutes), rate(initial_rate) {}
+
+    void configure(AdmissionMode new_mode, double new_threshold) {
+        if (new_threshold <= 0) throw invalid_argument("Admission threshold must be positive.");
+        mode = new_mode;
+        threshold_minutes = new_threshold;
+    }
+    AdmissionMode currentMode() const { return mode; }
+    double serviceRate() const { return rate; }
+
+    // Expected wait in minutes for a patient with `ahead` patients in front of them
+    double expectedWait(size_t ahead) const { return (ahead + 1) / rate; }
+
+    // Fold one tick of service into the rate. With patients still waiting, what was served is the
+    // real throughput; with the queues drained, the unused capacity counts as well.
+    void recordService(int served, int capacity, bool backlog, SimTime tick_length) {
+        double minutes = static_cast<double>(tick_length) / ms_per_minute;
+        double sample = (backlog ? served : max(served, capacity)) / minutes;
+        double alpha = 1 - std::pow(1 - alpha_per_minute, minutes);
+        rate = max(0.1, rate + alpha * (sample - rate));  // Keep the estimate finite when nothing is served
+    }
+
+    // Decide for a patient offered for the `attempt`-th time (0 = on arrival)
+    Decision decide(bool urgent, size_t ahead, int attempt) {
+        Decision decision = Admit;
+        if (!urgent && mode != AdmissionMode::Off) {
+            double estimate = expectedWait(ahead);
+            worst_estimate = max(worst_estimate, estimate);
+            if (estimate > threshold_minutes) {
+                decision = mode == AdmissionMode::Defer && attempt + 1 < max_defers ? Defer : Redirect;
+            }
+        }
+        if (attempt == 0 || decision != Defer) counts[decision]++;  // Count each patient once per outcome
+        if (attempt > 0 && decision == Admit) readmitted++;
+        return decision;
+    }
+
+    void displayStatistics() const {
+        if (mode == AdmissionMode::Off) return;
+        cout << "Admission control (" << (mode == AdmissionMode::Defer ? "defer" : "redirect")
+             << ", threshold " << fixed << setprecision(1) << threshold_minutes << " min): "
+             << counts[Admit] << " admitted (" << readmitted << " after deferral), "
+             << counts[Defer] << " deferred, " << counts[Redirect] << " redirected; "
+             << "service rate " << setprecision(2) << rate << "/min, worst estimate "
+             << setprecision(1) << worst_estimate << " min\n";
+    }
+};
+
+// WaitPredictor Class: Predicted wait for a patient joining a queue, and how good the predictions were.
+// A patient waits for everyone ahead of them to be served at the smoothed service rate. A normal
+// patient also waits for urgent patients who arrive meanwhile and go first, so their queue moves
+// at the service rate less the smoothed urgent arrival rate. Each prediction is O(1).
+class WaitPredictor {
+    double urgent_rate = 0;                  // Urgent arrivals per minute, smoothed
+    double alpha_per_minute = 0.2;           // Weight of a one-minute sample in the average
+    int urgent_this_tick = 0;
+
+    // PredictionAccuracy: Predicted against actual waits for served patients of one class
+    struct PredictionAccuracy {
+        long long checked = 0, within = 0;   // Served patients, and those within tolerance of their prediction
+        double error_sum = 0;                // Actual minus predicted, minutes
+        double abs_error_sum = 0;
+    };
+    PredictionAccuracy accuracy[2];          // Urgent / normal
+
+public:
+    static constexpr double tolerance_minutes = 2.0;  // A prediction this close counts as right
+
+    // Predicted wait for a patient with `position` patients ahead in their own queue and `higher`
+    // waiting in queues served before theirs, given the service rate in patients per minute
+    SimTime predict(bool urgent, size_t position, size_t higher, double service_rate) const {
+        double rate = urgent ? service_rate : max(0.1 * service_rate, service_rate - urgent_rate);
+        return static_cast<SimTime>((position + higher) / rate * ms_per_minute);
+    }
+
+    void noteArrival(bool urgent) {
+        if (urgent) urgent_this_tick++;
+    }
+
+    // Fold one tick's urgent arrivals into the rate
+    void recordTick(SimTime tick_length) {
+        double minutes = static_cast<double>(tick_length) / ms_per_minute;
+        double alpha = 1 - std::pow(1 - alpha_per_minute, minutes);
+        urgent_rate += alpha * (urgent_this_tick / minutes - urgent_rate);
+        urgent_this_tick = 0;
+    }
+
+    // Compare a served patient's actual wait with what they were told
+    void recordOutcome(bool urgent, SimTime predicted, SimTime actual) {
+        PredictionAccuracy& a = accuracy[urgent ? 0 : 1];
+        double error = static_cast<double>(actual - predicted) / ms_per_minute;
+        a.checked++;
+        a.error_sum += error;
+        a.abs_error_sum += std::fabs(error);
+        if (std::fabs(error) <= tolerance_minutes) a.within++;
+    }
+
+    double urgentRate() const { return urgent_rate; }
+
+    void displayStatistics(bool urgent) const {
+        const PredictionAccuracy& a = accuracy[urgent ? 0 : 1];
+        if (a.checked == 0) return;
+        cout << (urgent ? "Urgent" : "Normal") << " wait predictions: " << a.checked << " checked, mean error "
+             << fixed << setprecision(2) << a.abs_error_sum / a.checked << " min, bias " << showpos << a.error_sum / a.checked
+             << noshowpos << " min, " << setprecision(1) << 100.0 * a.within / a.checked << "% within "
+             << tolerance_minutes << " min\n";
+    }
+};
+
+// IntakeBuffer Class: Bounded hand-off between registration sources and the scheduling core.
+// Sources submit patients from any thread; the core drains a limited number per tick.
+// When the buffer fills to the high watermark it throttles until drained to the low
+// watermark. While throttled, a Block source waits in submit() and a Nack source is
+// refused at once, so the buffer never holds more than the high watermark.
+enum class Backpressure { Block, Nack };
+
+class IntakeBuffer {
+    // IntakeSource: One registration source and how it was throttled
+    struct IntakeSource {
+        string name;
+        Backpressure mode;
+        long long offered = 0, accepted = 0, refused = 0;
+        long long blocked = 0;        // Submits that had to wait
+        double blocked_seconds = 0;   // Wall time spent waiting
+    };
+
+    size_t high_watermark, low_watermark;
+    mutable mutex lock;                 // Guards the fields below
+    condition_variable drained;         // Signals that the buffer left the throttled state, or closed
+    deque<Patient> pending;
+    vector<IntakeSource> sources;
+    bool throttled = false;
+    bool closed = false;
+    size_t peak_depth = 0;
+    long long throttle_episodes = 0;
+    long long drained_total = 0;
+
+public:
+    IntakeBuffer(size_t high_watermark, size_t low_watermark)
+        : high_watermark(high_watermark), low_watermark(low_watermark) {
+        if (high_watermark == 0 || low_watermark >= high_watermark) {
+            throw invalid_argument("Intake watermarks must satisfy 0 <= low < high.");
+        }
+    }
+
+    int addSource(const string& name, Backpressure mode) {
+        lock_guard<mutex> guard(lock);
+        sources.push_back(IntakeSource{name, mode});
+        return static_cast<int>(sources.size()) - 1;
+    }
+
+    // Hand a patient to the core; returns false if refused (Nack source while throttled, or closed)
+    bool submit(int source, Patient patient) {
+        unique_lock<mutex> guard(lock);
+        IntakeSource& s = sources[source];
+        s.offered++;
+        if (throttled && !closed) {
+            if (s.mode == Backpressure::Nack) {
+                s.refused++;
+                return false;
+            }
+            s.blocked++;
+            auto start = chrono::steady_clock::now();
+            drained.wait(guard, [this] { return !throttled || closed; });
+            s.blocked_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+        if (closed) {
+            s.refused++;
+            return false;
+        }
+        pending.push_back(move(patient));
+        s.accepted++;
+        peak_depth = max(peak_depth, pending.size());
+        if (pending.size() >= high_watermark) {
+            throttled = true;
+            throttle_episodes++;
+        }
+        return true;
+    }
+
+    // Move up to `limit` patients, oldest first, into `out`; returns how many were moved
+    size_t drain(size_t limit, vector<Patient>& out) {
+        bool released = false;
+        size_t moved = 0;
+        {
+            lock_guard<mutex> guard(lock);
+            for (; moved < limit && !pending.empty(); moved++) {
+                out.push_back(move(pending.front()));
+                pending.pop_front();
+            }
+            drained_total += static_cast<long long>(moved);
+            if (throttled && pending.size() <= low_watermark) {
+                throttled = false;
+                released = true;
+            }
+        }
+        if (released) drained.notify_all();
+        return moved;
+    }
+
+    // Refuse further submits and wake any blocked source
+    void close() {
+        {
+            lock_guard<mutex> guard(lock);
+            closed = true;
+        }
+        drained.notify_all();
+    }
+
+    size_t depth() const {
+        lock_guard<mutex> guard(lock);
+        return pending.size();
+    }
+
+    // Find a registered patient the core has not admitted yet; `position` counts from the oldest
+    bool findPending(const string& id, size_t& position) const {
+        lock_guard<mutex> guard(lock);
+        for (position = 0; position < pending.size(); position++) {
+            if (pending[position].getId() == id) return true;
+        }
+        return false;
+    }
+
+    void displayStatistics() const {
+        lock_guard<mutex> guard(lock);
+        cout << "Intake buffer: " << pending.size() << " pending (peak " << peak_depth << ", watermarks "
+             << low_watermark << "/" << high_watermark << "), " << drained_total << " drained, "
+             << throttle_episodes << " throttle episodes" << (throttled ? ", throttled now" : "") << "\n";
+        for (const auto& s : sources) {
+            cout << "  " << left << setw(8) << s.name << right << (s.mode == Backpressure::Block ? " block" : " nack ")
+                 << ": " << s.offered << " offered, " << s.accepted << " accepted, " << s.refused << " refused, "
+                 << s.blocked << " blocked for " << fixed << setprecision(3) << s.blocked_seconds << " s\n";
+        }
+    }
+};
+
+// DepthTracker Class: Depth of one class of queue over time: high-water mark, time-weighted
+// average and a histogram of time spent at each depth. Every join or departure is O(1): the
+// time since the last change is credited to the old depth before it changes. The scheduler
+// closes hours and days, and each closed period keeps its own summary.
+class DepthTracker {
+public:
+    static const int depth_buckets = 16;  // Bucket 0 is empty; bucket b > 0 holds depths 2^(b-1) to 2^b - 1
+
+    // DepthPeriod: Summary of one hour or day
+    struct DepthPeriod {
+        int64_t start_minute = 0;
+        size_t high_water = 0;                   // Deepest the queue got, even within a tick
+        SimTime length = 0;                      // Time covered so far
+        double depth_time = 0;                   // Integral of depth over time (patients x ms)
+        SimTime time_at[depth_buckets] = {};     // Time spent at each depth bucket
+
+        double average() const { return length > 0 ? depth_time / length : 0; }
+    };
+
+    static int bucketOf(size_t depth) { return depth == 0 ? 0 : min(depth_buckets - 1, highestSetBit(depth) + 1); }
+
+private:
+    size_t depth = 0;
+    SimTime last_change = 0;
+    DepthPeriod hour, day;          // Periods in progress
+    vector<DepthPeriod> hours;      // Closed hours of the current day
+    vector<DepthPeriod> days;       // Closed days
+
+    // Credit the time since the last change to the current depth
+    void credit(SimTime now) {
+        if (now <= last_change) return;
+        SimTime span = now - last_change;
+        for (DepthPeriod* period : {&hour, &day}) {
+            period->length += span;
+            period->depth_time += static_cast<double>(depth) * span;
+            period->time_at[bucketOf(depth)] += span;
+        }
+        last_change = now;
+    }
+
+    // Start a period at `now`, at the depth the queue already has
+    DepthPeriod begin(SimTime now) const {
+        DepthPeriod period;
+        period.start_minute = now / ms_per_minute;
+        period.high_water = depth;
+        return period;
+    }
+
+public:
+    // A patient joined the queue at `now` (times earlier than the last change count as the last change)
+    void join(SimTime now) {
+        credit(now);
+        depth++;
+        hour.high_water = max(hour.high_water, depth);
+        day.high_water = max(day.high_water, depth);
+    }
+
+    // A patient left the queue at `now`
+    void leave(SimTime now) {
+        credit(now);
+        depth--;
+    }
+
+    // Nothing joined or left up to `now`: credit the time so far to the current depth
+    void advance(SimTime now) { credit(now); }
+
+    void closeHour(SimTime now) {
+        credit(now);
+        hours.push_back(hour);
+        hour = begin(now);
+    }
+
+    // Close the day; its hours are dropped with it
+    void closeDay(SimTime now) {
+        credit(now);
+        days.push_back(day);
+        day = begin(now);
+        hours.clear();
+    }
+
+    const vector<DepthPeriod>& closedHours() const { return hours; }
+    const vector<DepthPeriod>& closedDays() const { return days; }
+    const DepthPeriod& currentHour() const { return hour; }
+    const DepthPeriod& currentDay() const { return day; }
+
+    // Deepest the queue has been over the whole run
+    size_t peak() const {
+        size_t high = day.high_water;
+        for (const DepthPeriod& d : days) high = max(high, d.high_water);
+        return high;
+    }
+};
+
+// QueuePositionIndex Class: Position of any patient in one queue in O(log n).
+// Each patient gets a ticket when joining, in queue order. A Fenwick tree over tickets
+// counts who is still waiting, so the patients ahead of a ticket are a prefix sum even
+// after patients further back were served out of turn. The tree restarts whenever the
+// queue empties, so its size is bounded by one busy spell rather than the whole run.
+class QueuePositionIndex {
+    vector<int32_t> tree;   // Fenwick tree over tickets first_ticket, first_ticket + 1, ...
+    uint64_t first_ticket = 0;
+    size_t waiting = 0;
+
+    // Patients still waiting among the first n tickets of the tree
+    int64_t prefix(size_t n) const {
+        int64_t sum = 0;
+        for (; n > 0; n &= n - 1) sum += tree[n - 1];
+        return sum;
+    }
+
+public:
+    // Ticket for a patient joining the back of the queue
+    uint64_t enter() {
+        if (waiting == 0) {
+            first_ticket += tree.size();
+            tree.clear();
+        }
+        // Appending node i covers tickets (i - lowbit(i), i]; all but the new one are already in the tree
+        size_t i = tree.size() + 1;
+        tree.push_back(static_cast<int32_t>(1 + prefix(i - 1) - prefix(i - (i & (0 - i)))));
+        waiting++;
+        return first_ticket + i - 1;
+    }
+
+    // A patient left the queue, from anywhere in it
+    void leave(uint64_t ticket) {
+        for (size_t i = ticket - first_ticket + 1; i <= tree.size(); i += i & (0 - i)) tree[i - 1]--;
+        waiting--;
+    }
+
+    // Patients still waiting ahead of a ticket
+    size_t ahead(uint64_t ticket) const { return static_cast<size_t>(prefix(ticket - first_ticket)); }
+    size_t size() const { return waiting; }
+};
+
+// ClassTotals: What happened to one class of patient over the run
+struct ClassTotals {
+    long long served = 0, expired = 0;
+    SimTime waiting_time = 0;   // Total wait of served patients
+    SimTime longest_wait = 0;   // Longest wait of a served patient
+};
+
+const int minutes_per_day = 24 * 60;  // Length of a simulated day
+const SimTime ms_per_day = minutes_per_day * ms_per_minute;
+
+// Scheduler Class: Handles the queuing and serving of patients under the rules of Policy
+template <class Policy = DefaultPolicy>
+class Scheduler {
+    // Department: One department's queues, its share of service and what it received
+    struct Department {
+        string name;
+        int weight;                         // Patients served per round-robin turn when departments compete
+        deque<Patient> urgent_queue;        // Queue for urgent patients
+        deque<Patient> normal_queue;        // Queue for normal patients
+        int deficit = 0;                    // Service credit left in the current turn
+        bool in_round = false;              // True while on the round-robin ring
+        int64_t last_expiry_tick[2] = {INT64_MIN, INT64_MIN};  // Per queue: due tick of the newest expiry timer
+        deque<uint64_t> tickets[2];         // Per queue: each waiting patient's position ticket, in queue order
+        QueuePositionIndex positions[2];    // Per queue: who is still waiting, by ticket
+        long long arrivals = 0, served = 0, expired = 0;
+        SimTime waiting_time = 0;           // Total wait of served patients (milliseconds)
+
+        Department(const string& name, int weight) : name(name), weight(weight) {}
+        size_t waiting() const { return urgent_queue.size() + normal_queue.size(); }
+        deque<Patient>& queue(bool urgent) { return urgent ? urgent_queue : normal_queue; }
+        const deque<Patient>& queue(bool urgent) const { return urgent ? urgent_queue : normal_queue; }
+    };
+
+    // WaitingEntry: Where a waiting patient is, for lookups by ID
+    struct WaitingEntry {
+        int department;
+        bool urgent;
+        uint64_t ticket;
+        SimTime predicted;                  // Wait the patient was told to expect
+    };
+
+    vector<Department> departments = {Department("General", 1)};  // Department 0 takes everyone by default
+    deque<int> round;                   // Departments with waiting patients, in deficit round-robin order
+    bool turn_open = false;             // The department at the front of `round` has had its quantum
+    size_t waiting_count[2] = {0, 0};   // Patients waiting in all urgent / all normal queues
+    unordered_map<string, WaitingEntry> waiting_index;  // Patient ID -> queue and ticket (the latest, if IDs repeat)
+    ClassTotals class_totals[2];        // Urgent / normal outcomes
+    DepthTracker depth_trackers[2];     // Urgent / normal depth over time, across all departments
+    WaitPredictor predictor;            // Predicted waits for new patients, and their accuracy
+    vector<Patient> served_patients;    // List of patients who have been served
+    int total_patients = 0;             // Total number of patients in the system
+    int total_urgent = 0;               // Count of urgent patients
+    int total_normal = 0;               // Count of normal patients
+    SimTime total_waiting_time = 0;     // Total waiting time for served patients (milliseconds)
+    int total_served = 0;               // Total number of patients served
+    SimTime tick_length;                // Simulated time covered by one tick
+    QueueSnapshot current = {};         // Activity counters for the minute in progress
+    QueueTimeSeries time_series;        // Per-minute history of queue activity
+    ServedHistory history;              // Indexed history of today's served patients
+    int history_day = 0;                // Day the history covers (day 0 starts at minute 0)
+    ArchiveStore archive;               // Finished days, compacted in the background
+    BedAllocator ward;                  // Ward beds for patients admitted after service
+    AppointmentCalendar calendar;       // Pre-booked appointments waiting for their slot
+    ClinicianPool clinician_pool;       // Clinicians on shift; empty means any server can treat anyone
+    TimingWheel timers;                 // Every timed event, in units of ticks
+    unordered_map<int, TimingWheel::TimerId> appointment_timers;  // Slot -> release timer
+    AdmissionController admission{Policy::max_wait * 0.8, (Policy::min_serve + Policy::max_serve) / 2.0};
+    unordered_map<uint64_t, pair<Patient, int>> deferred;  // Deferral number -> patient and offers so far
+    unordered_map<string, uint64_t> deferred_by_id;        // Patient ID -> deferral number
+    uint64_t next_deferral = 0;
+
+    // First tick at or after a time, so a timer never fires early
+    int64_t tickAtOrAfter(SimTime t) const { return t <= 0 ? t / tick_length : (t + tick_length - 1) / tick_length; }
+
+    // What a timer does when it fires; its argument is given with each kind
+    enum TimerKind : uint32_t {
+        BedDischarge,     // arg = bed number
+        AppointmentDue,   // arg = slot minute
+        QueueExpiry,      // arg = department * 2, plus 1 for the normal queue
+        AdmissionRetry    // arg = deferral number
+    };
+
+    void onTimer(uint32_t kind, uint64_t arg, SimTime now);
+
+    // Patients skipped for want of a clinician with their skills, before the queue is given up on for the tick
+    static const size_t skill_lookahead = 32;
+
+    // True while someone can still see a patient this tick
+    bool cliniciansLeft() const { return clinician_pool.size() == 0 || clinician_pool.freeCount() > 0; }
+
+    // True if a clinician is available for the patient (always, when no roster is set up)
+    bool matchClinician(const Patient& p) {
+        return clinician_pool.size() == 0 || clinician_pool.assign(p.getRequiredSkills()) != ClinicianPool::no_match;
+    }
+
+    // Put patients skipped this tick back at the front of their queue, in their original order and with their tickets
+    static void returnHeld(Department& d, bool urgent, vector<pair<Patient, uint64_t>>& held) {
+        for (auto it = held.rbegin(); it != held.rend(); ++it) {
+            d.queue(urgent).push_front(it->first);
+            d.tickets[urgent ? 0 : 1].push_front(it->second);
+        }
+        held.clear();
+    }
+
+    // Take the patient at the front of a queue, with their ticket; they still count as waiting until leaveQueue
+    pair<Patient, uint64_t> takeFront(Department& d, bool urgent) {
+        pair<Patient, uint64_t> front(d.queue(urgent).front(), d.tickets[urgent ? 0 : 1].front());
+        d.queue(urgent).pop_front();
+        d.tickets[urgent ? 0 : 1].pop_front();
+        return front;
+    }
+
+    // A patient taken from a queue at `now` has been served or has expired; returns the wait
+    // they were predicted, or -1 if a later patient with the same ID has taken over the lookup
+    SimTime leaveQueue(Department& d, bool urgent, const string& id, uint64_t ticket, SimTime now) {
+        d.positions[urgent ? 0 : 1].leave(ticket);
+        waiting_count[urgent ? 0 : 1]--;
+        depth_trackers[urgent ? 0 : 1].leave(now);
+        auto it = waiting_index.find(id);
+        if (it != waiting_index.end() && it->second.ticket == ticket && it->second.urgent == urgent
+            && &departments[it->second.department] == &d) {
+            SimTime predicted = it->second.predicted;
+            waiting_index.erase(it);
+            return predicted;
+        }
+        return -1;
+    }
+
+    // Record a patient dropped after waiting too long
+    void countExpired(Department& d, bool urgent) {
+        d.expired++;
+        class_totals[urgent ? 0 : 1].expired++;
+        if (urgent) current.urgent_expired++;
+        else current.normal_expired++;
+    }
+    void expireWaiting(Department& d, bool urgent, SimTime now);
+    int serveQueue(Department& d, bool urgent, int limit, SimTime now);
+    int serveRoundRobin(int max_to_serve, SimTime now);
+
+    // Patients waiting in every department's urgent or normal queue
+    size_t waitingCount(bool urgent) const { return waiting_count[urgent ? 0 : 1]; }
+
+    // Patients a new arrival would wait behind: the urgent queues, plus the normal queues for a normal patient
+    size_t patientsAhead(bool urgent) const { return waiting_count[0] + (urgent ? 0 : waiting_count[1]); }
+
+    AdmissionController::Decision offer(const Patient& patient, int attempt, SimTime now, SimTime* predicted_wait = nullptr);
+
+    // Send a just-served patient to a ward bed if the policy admits their class
+    void admitIfNeeded(const Patient& p, bool urgent, SimTime now) {
+        if ((urgent ? Policy::admit_urgent : Policy::admit_normal) && ward.hasBeds()) {
+            MemScope scope(MemTag::Ward);
+            int stay = rand() % (Policy::max_stay - Policy::min_stay + 1) + Policy::min_stay;
+            int bed = ward.admit(p.getId(), p.getGender(), static_cast<int>(now / ms_per_minute), stay);
+            if (bed >= 0) {
+                timers.schedule(tickAtOrAfter(now + stay * ms_per_minute), BedDischarge, static_cast<uint64_t>(bed));
+            }
+        }
+    }
+
+public:
+    explicit Scheduler(SimTime tick_length = ms_per_minute) : tick_length(tick_length) {
+        if (tick_length <= 0) throw invalid_argument("Tick length must be positive.");
+    }
+
+    SimTime addPatient(const Patient& patient);  // Add patient to the appropriate queue; returns the predicted wait
+    void servePatients(int max_to_serve, SimTime now);  // Serve patients based on available slots
+    void displayQueues();                    // Display current state of queues
+    void displayStatistics();                // Display simulation statistics
+    void recordTick(SimTime now);            // Close the tick starting at `now`; appends finished minutes to the time series
+    void flushPartialMinute(SimTime now);    // At the end of the simulation, append the minute cut short at `now`
+    SimTime tickLength() const { return tick_length; }
+    QueueTimeSeries& timeSeries() { return time_series; }
+    const QueueTimeSeries& timeSeries() const { return time_series; }
+    const ServedHistory& servedHistory() const { return history; }
+    int servedHistoryDay() const { return history_day; }
+    const ArchiveStore& archiveStore() const { return archive; }
+    ArchiveStore& archiveStore() { return archive; }
+    BedAllocator& beds() { return ward; }
+    const AppointmentCalendar& appointments() const { return calendar; }
+    ClinicianPool& clinicians() { return clinician_pool; }
+    void bookAppointment(const Patient& patient, int slot);  // Book a slot and set its release timer
+    bool cancelAppointment(const string& id);                // Cancel a booking and its timer
+    void displayMemory() const;              // Display heap usage per subsystem
+    int totalServed() const { return total_served; }
+    int totalPatients() const { return total_patients; }
+    int totalArrivals(bool urgent) const { return urgent ? total_urgent : total_normal; }
+    const ClassTotals& classTotals(bool urgent) const { return class_totals[urgent ? 0 : 1]; }
+    const string& departmentName(int index) const { return departments[index].name; }
+    bool isDeferred(const string& id) const { return deferred_by_id.count(id) > 0; }
+
+    // WaitingPlace: Where a waiting patient stands
+    struct WaitingPlace {
+        int department;
+        bool urgent;
+        size_t position;   // Patients ahead in the same queue
+        size_t ahead;      // Patients seen first: the position, plus every urgent patient for a normal patient
+        SimTime arrival;
+        SimTime predicted; // Wait predicted when they joined
+    };
+
+    // Find a waiting patient by ID in O(log n); returns false if they are not in a queue
+    bool locate(const string& id, WaitingPlace& place) const {
+        auto it = waiting_index.find(id);
+        if (it == waiting_index.end()) return false;
+        const WaitingEntry& e = it->second;
+        const Department& d = departments[e.department];
+        place.department = e.department;
+        place.urgent = e.urgent;
+        place.position = d.positions[e.urgent ? 0 : 1].ahead(e.ticket);
+        place.ahead = place.position + (e.urgent ? 0 : waiting_count[0]);
+        place.arrival = d.queue(e.urgent)[place.position].getArrivalStamp();
+        place.predicted = e.predicted;
+        return true;
+    }
+
+    vector<Patient> longestWaiting(size_t k) const;          // The k patients waiting longest, longest first
+    size_t queueDepth(bool urgent) const { return waitingCount(urgent); }  // Patients waiting in all urgent or all normal queues
+    bool isUrgentQueueEmpty() const { return waitingCount(true) == 0; }  // Check if the urgent queues are empty
+    bool isNormalQueueEmpty() const { return waitingCount(false) == 0; }  // Check if the normal queues are empty
+
+    // Add a department with a fair-share weight, or change the weight of an existing one; returns its index
+    int addDepartment(const string& name, int weight) {
+        if (weight < 1) throw invalid_argument("Department weight must be at least 1.");
+        int index = departmentIndex(name);
+        if (index >= 0) {
+            departments[index].weight = weight;
+            return index;
+        }
+        departments.emplace_back(name, weight);
+        return static_cast<int>(departments.size()) - 1;
+    }
+
+    // Index of a department by name, or -1
+    int departmentIndex(const string& name) const {
+        for (size_t i = 0; i < departments.size(); i++) {
+            if (departments[i].name == name) return static_cast<int>(i);
+        }
+        return -1;
+    }
+
+    void displayDepartments() const;         // Display per-department service and fairness
+    void displayDepths() const;              // Display queue depth peaks, averages and histograms
+    const DepthTracker& depthTracker(bool urgent) const { return depth_trackers[urgent ? 0 : 1]; }
+    AdmissionController& admissionControl() { return admission; }
+    size_t deferredCount() const { return deferred.size(); }
+
+    // Offer a newly arrived patient to admission control: admitted patients are queued as by addPatient,
+    // and their predicted wait is stored in `predicted_wait` if given
+    AdmissionController::Decision offerPatient(const Patient& patient, SimTime now, SimTime* predicted_wait = nullptr) {
+        return offer(patient, 0, now, predicted_wait);
+    }
+    const WaitPredictor& waitPredictor() const { return predictor; }
+
+    // Randomly pick how many patients can be served this minute, within the policy's range
+    static int drawServiceCapacity() {
+        return rand() % (Policy::max_serve - Policy::min_serve + 1) + Policy::min_serve;
+    }
+
+    // Service capacity for one tick: the per-minute draw scaled to the tick, with the fraction rounded at random
+    int drawTickCapacity() const {
+        if (tick_length == ms_per_minute) return drawServiceCapacity();
+        double scaled = static_cast<double>(drawServiceCapacity()) * tick_length / ms_per_minute;
+        int whole = static_cast<int>(scaled);
+        return whole + (rand() < (scaled - whole) * RAND_MAX ? 1 : 0);
+    }
+};
+
+// Add a patient to the correct queue based on their type, and predict their wait from the
+// patients ahead of them in their queue, the urgent patients served first and the service rate
+template <class Policy>
+SimTime Scheduler<Policy>::addPatient(const Patient& patient) {
+    MemCall call(MemOp::AddPatient);
+    MemScope scope(MemTag::Queues);
+    PerfScope perf(PerfRegion::AddPatient);
+    bool urgent = patient.getType() == Policy::urgent_type;
+    int index = patient.getDepartment();
+    if (index < 0 || index >= static_cast<int>(departments.size())) {
+        throw invalid_argument("Unknown department " + to_string(index) + ".");
+    }
+    Department& d = departments[index];
+    waiting_count[urgent ? 0 : 1]++;
+    depth_trackers[urgent ? 0 : 1].join(patient.getArrivalStamp());
+    uint64_t ticket = d.positions[urgent ? 0 : 1].enter();
+    d.tickets[urgent ? 0 : 1].push_back(ticket);
+    size_t position = d.positions[urgent ? 0 : 1].size() - 1;  // Everyone else in the queue is ahead
+    // Nobody waits past max_wait, so a longer prediction means the patient is likely to give up at that point
+    SimTime predicted = min(predictor.predict(urgent, position, urgent ? 0 : waiting_count[0], admission.serviceRate()),
+                            static_cast<SimTime>(Policy::max_wait) * ms_per_minute);
+    waiting_index[patient.getId()] = {index, urgent, ticket, predicted};
+    predictor.noteArrival(urgent);
+    if (urgent) {
+        d.urgent_queue.push_back(patient);   // Add to urgent queue
+        total_urgent++;
+        current.urgent_arrivals++;
+    } else {
+        d.normal_queue.push_back(patient);   // Add to normal queue
+        total_normal++;
+        current.normal_arrivals++;
+    }
+    total_patients++;  // Increment total patients count
+    d.arrivals++;
+    if (!d.in_round) {
+        d.in_round = true;
+        round.push_back(index);
+    }
+
+    // One expiry timer per queue and due tick covers every patient whose wait runs out in that tick
+    int64_t due = tickAtOrAfter(patient.getArrivalStamp() + Policy::max_wait * ms_per_minute + 1);
+    if (d.last_expiry_tick[urgent ? 0 : 1] != due) {
+        timers.schedule(due, QueueExpiry, static_cast<uint64_t>(index) * 2 + (urgent ? 0 : 1));
+        d.last_expiry_tick[urgent ? 0 : 1] = due;
+    }
+    return predicted;
+}
+
+// Drop patients at the front of a queue who have waited longer than the policy allows.
+// Queues are in arrival order, so everyone expired is at the front.
+template <class Policy>
+void Scheduler<Policy>::expireWaiting(Department& d, bool urgent, SimTime now) {
+    deque<Patient>& q = d.queue(urgent);
+    while (!q.empty() && now - q.front().getArrivalStamp() > Policy::max_wait * ms_per_minute) {
+        pair<Patient, uint64_t> front = takeFront(d, urgent);
+        leaveQueue(d, urgent, front.first.getId(), front.second, now);
+        countExpired(d, urgent);
+    }
+}
+
+// Carry out a timer that has come due
+template <class Policy>
+void Scheduler<Policy>::onTimer(uint32_t kind, uint64_t arg, SimTime now) {
+    switch (kind) {
+    case BedDischarge: {
+        MemScope scope(MemTag::Ward);
+        ward.discharge(static_cast<int>(arg));
+        break;
+    }
+    case AppointmentDue: {
+        // The appointment joins the normal queue alongside the walk-ins
+        MemScope scope(MemTag::Appointments);
+        int slot = static_cast<int>(arg);
+        appointment_timers.erase(slot);
+        Patient patient = calendar.take(slot);
+        patient.setArrivalStamp(now);  // The wait starts when the slot comes round, not at booking
+        addPatient(patient);
+        break;
+    }
+    case QueueExpiry:
+        expireWaiting(departments[arg / 2], arg % 2 == 0, now);
+        break;
+    case AdmissionRetry: {
+        // A deferred patient comes back and is offered again, as if arriving now
+        auto it = deferred.find(arg);
+        pair<Patient, int> entry = it->second;
+        deferred.erase(it);
+        auto by_id = deferred_by_id.find(entry.first.getId());
+        if (by_id != deferred_by_id.end() && by_id->second == arg) deferred_by_id.erase(by_id);
+        entry.first.setArrivalStamp(now);
+        offer(entry.first, entry.second, now);
+        break;
+    }
+    }
+}
+
+// Admit, defer or redirect a patient on their `attempt`-th offer
+template <class Policy>
+AdmissionController::Decision Scheduler<Policy>::offer(const Patient& patient, int attempt, SimTime now, SimTime* predicted_wait) {
+    bool urgent = patient.getType() == Policy::urgent_type;
+    AdmissionController::Decision decision = admission.decide(urgent, patientsAhead(urgent), attempt);
+    if (decision == AdmissionController::Admit) {
+        SimTime predicted = addPatient(patient);
+        if (predicted_wait) *predicted_wait = predicted;
+    } else if (decision == AdmissionController::Defer) {
+        uint64_t number = next_deferral++;
+        deferred.emplace(number, make_pair(patient, attempt + 1));
+        deferred_by_id[patient.getId()] = number;
+        timers.schedule(tickAtOrAfter(now + AdmissionController::defer_minutes * ms_per_minute), AdmissionRetry, number);
+    }
+    return decision;
+}
+
+// Book an appointment and set the timer that releases it at its slot
+template <class Policy>
+void Scheduler<Policy>::bookAppointment(const Patient& patient, int slot) {
+    MemScope scope(MemTag::Appointments);
+    calendar.book(patient, slot);
+    appointment_timers[slot] = timers.schedule(tickAtOrAfter(slot * ms_per_minute), AppointmentDue, static_cast<uint64_t>(slot));
+}
+
+// Cancel a patient's appointment and its release timer; returns false if they had none
+template <class Policy>
+bool Scheduler<Policy>::cancelAppointment(const string& id) {
+    int slot = calendar.slotOf(id);
+    if (slot < 0) return false;
+    calendar.cancel(id);
+    timers.cancel(appointment_timers[slot]);
+    appointment_timers.erase(slot);
+    return true;
+}
+
+// Serve up to `limit` patients from one department queue, in arrival order; returns how many were served
+template <class Policy>
+int Scheduler<Policy>::serveQueue(Department& d, bool urgent, int limit, SimTime now) {
+    deque<Patient>& q = d.queue(urgent);
+    vector<pair<Patient, uint64_t>> held;  // Patients passed over this tick because no clinician had their skills
+    int served = 0;
+    while (served < limit && !q.empty() && held.size() < skill_lookahead && cliniciansLeft()) {
+        try {
+            if (!q.empty()) {
+                pair<Patient, uint64_t> front = takeFront(d, urgent);  // Remove the patient from the queue
+                const Patient& p = front.first;
+
+                // Calculate the waiting time for the patient
+                SimTime waiting_time = now - p.getArrivalStamp();
+
+                if (waiting_time > Policy::max_wait * ms_per_minute) {
+                    // Skip serving if the patient has been waiting too long (more than max_wait minutes).
+                    // Expiry timers normally remove them first; this covers patients added with an old arrival time.
+                    leaveQueue(d, urgent, p.getId(), front.second, now);
+                    countExpired(d, urgent);
+                    continue;
+                }
+                if (!matchClinician(p)) {
+                    held.push_back(front);  // Wait for a suitable clinician; later patients may still be seen
+                    continue;
+                }
+
+                SimTime predicted = leaveQueue(d, urgent, p.getId(), front.second, now);
+                if (predicted >= 0) predictor.recordOutcome(urgent, predicted, waiting_time);
+                ClassTotals& totals = class_totals[urgent ? 0 : 1];
+                totals.served++;
+                totals.waiting_time += waiting_time;
+                totals.longest_wait = max(totals.longest_wait, waiting_time);
+                served_patients.push_back(p);  // Add patient to served list
+                history.add(ServedRecord::make(p.getId(), p.getGender(), urgent, p.getArrivalStamp(), now));
+                admitIfNeeded(p, urgent, now);
+                total_waiting_time += waiting_time;  // Add waiting time to the total
+                d.waiting_time += waiting_time;
+                d.served++;
+                served++;  // Increment the number of patients served
+                if (urgent) current.urgent_served++;
+                else current.normal_served++;
+            } else {
+                throw runtime_error("Queue is empty!");  // Error if the queue is empty
+            }
+        } catch (const exception& e) {
+            cout << "Error while serving " << (urgent ? "urgent" : "normal") << " patients: " << e.what() << endl;
+        }
+    }
+    returnHeld(d, urgent, held);
+    return served;
+}
+
+// Share the tick's capacity between departments by deficit round robin: each turn a department
+// may serve up to its weight in patients, urgent before normal, then goes to the back of the ring.
+// A turn cut short by the end of the tick's capacity or clinicians resumes with its remaining
+// credit on the next tick.
+// Each served patient costs O(1) apart from departments whose turn serves nobody, and those
+// end the loop once every department in the ring has had a fruitless turn.
+template <class Policy>
+int Scheduler<Policy>::serveRoundRobin(int max_to_serve, SimTime now) {
+    int served = 0;
+    size_t fruitless = 0;  // Consecutive turns that served nobody
+    while (served < max_to_serve && !round.empty() && fruitless < round.size() && cliniciansLeft()) {
+        Department& d = departments[round.front()];
+        if (!turn_open) {
+            d.deficit += d.weight;
+            turn_open = true;
+        }
+        int limit = min(d.deficit, max_to_serve - served);
+        int got = serveQueue(d, true, limit, now);
+        got += serveQueue(d, false, limit - got, now);
+        served += got;
+        d.deficit -= got;
+        if (got > 0) fruitless = 0;
+        else if (d.waiting() > 0) fruitless++;  // Everyone left is waiting for a clinician with their skills
+
+        if ((served == max_to_serve || !cliniciansLeft()) && d.deficit > 0 && d.waiting() > 0) {
+            break;  // Out of capacity or clinicians mid-turn; the department keeps its place and credit
+        }
+        // The turn is over: credit does not carry into the next one
+        round.pop_front();
+        turn_open = false;
+        d.deficit = 0;
+        if (d.waiting() > 0) round.push_back(static_cast<int>(&d - departments.data()));
+        else d.in_round = false;
+    }
+    return served;
+}
+
+// Serve patients with priority given to urgent cases
+template <class Policy>
+void Scheduler<Policy>::servePatients(int max_to_serve, SimTime now) {
+    MemCall call(MemOp::ServePatients);
+    PerfScope perf(PerfRegion::ServePatients);
+    int served = 0;
+
+    // Fire every timer due by now: bed discharges, appointment releases and queue expiries
+    timers.advance(now / tick_length, [&](uint32_t kind, uint64_t arg) { onTimer(kind, arg, now); });
+
+    // Move patients blocked for a bed into the beds just freed
+    {
+        MemScope scope(MemTag::Ward);
+        for (const auto& placed : ward.placeWaiting(static_cast<int>(now / ms_per_minute))) {
+            timers.schedule(tickAtOrAfter(now + placed.second * ms_per_minute), BedDischarge, static_cast<uint64_t>(placed.first));
+        }
+    }
+    MemScope scope(MemTag::Queues);
+
+    // Every clinician is free again at the start of a tick
+    clinician_pool.releaseAll();
+
+    if (departments.size() == 1) {
+        // One department: serve urgent patients first, then normal patients if there's room
+        Department& d = departments[0];
+        served += serveQueue(d, true, max_to_serve, now);
+        served += serveQueue(d, false, max_to_serve - served, now);
+    } else {
+        // Several departments: urgent still goes first within a department, but departments take turns
+        served = serveRoundRobin(max_to_serve, now);
+    }
+
+    total_served += served;  // Update total number of served patients
+    admission.recordService(served, max_to_serve, waiting_count[0] + waiting_count[1] > 0, tick_length);
+    predictor.recordTick(tick_length);
+    perf.setPatients(served);
+}
+
+// Display the current state of the urgent and normal queues
+template <class Policy>
+void Scheduler<Policy>::displayQueues() {
+    cout << "\nCurrent State of Queues:\n";
+
+    for (const auto& d : departments) {
+        string label = departments.size() == 1 ? "" : " [" + d.name + "]";
+
+        // Display the IDs of patients in the urgent queue
+        cout << "Urgent Queue" << label << ": ";
+        for (const auto& p : d.urgent_queue) {
+            cout << p.getId() << " ";
+        }
+        cout << endl;
+
+        // Display the IDs of patients in the normal queue
+        cout << "Normal Queue" << label << ": ";
+        for (const auto& p : d.normal_queue) {
+            cout << p.getId() << " ";
+        }
+        cout << endl;
+    }
+
+    // Display the IDs of currently served patients
+    cout << "Currently Served Patients: ";
+    for (const auto& p : served_patients) {
+        cout << p.getId() << " ";
+    }
+    cout << endl;
+}
+
+// The k patients who have waited longest. Each queue is in arrival order, so this merges
+// the queues from their fronts: O(queues + k log queues) however many are waiting.
+template <class Policy>
+vector<Patient> Scheduler<Policy>::longestWaiting(size_t k) const {
+    typedef pair<const deque<Patient>*, size_t> Cursor;  // Queue and next index in it
+    auto later = [](const Cursor& a, const Cursor& b) {
+        return (*a.first)[a.second].getArrivalStamp() > (*b.first)[b.second].getArrivalStamp();
+    };
+    priority_queue<Cursor, vector<Cursor>, decltype(later)> fronts(later);
+    for (const Department& d : departments) {
+        if (!d.urgent_queue.empty()) fronts.push(Cursor(&d.urgent_queue, 0));
+        if (!d.normal_queue.empty()) fronts.push(Cursor(&d.normal_queue, 0));
+    }
+    vector<Patient> result;
+    while (result.size() < k && !fronts.empty()) {
+        Cursor c = fronts.top();
+        fronts.pop();
+        result.push_back((*c.first)[c.second]);
+        if (++c.second < c.first->size()) fronts.push(c);
+    }
+    return result;
+}
+
+// Close the tick that started at `now`. When the tick finishes a minute, the activity
+// gathered since the last snapshot is appended to the time series under that minute.
+template <class Policy>
+void Scheduler<Policy>::recordTick(SimTime now) {
+    MemScope scope(MemTag::TimeSeries);
+    SimTime end = now + tick_length;
+    if (end / ms_per_minute > now / ms_per_minute) {
+        current.minute = static_cast<int32_t>((end - 1) / ms_per_minute);
+        current.urgent_depth = static_cast<int32_t>(waitingCount(true));
+        current.normal_depth = static_cast<int32_t>(waitingCount(false));
+        time_series.append(current);
+        current = QueueSnapshot{};  // Reset the counters for the next minute
+    }
+
+    // Close the depth trackers' hour, and their day at midnight
+    const SimTime ms_per_hour = 60 * ms_per_minute;
+    int64_t day = now / ms_per_day;
+    if (end / ms_per_hour > now / ms_per_hour) {
+        SimTime boundary = end - end % ms_per_hour;
+        for (DepthTracker& tracker : depth_trackers) {
+            tracker.closeHour(boundary);
+            if (end >= (day + 1) * ms_per_day) tracker.closeDay(boundary);
+        }
+    }
+    // Depths only change during a tick, so both trackers are credited to its end; the hour and
+    // day in progress then cover the same span for both queues
+    for (DepthTracker& tracker : depth_trackers) tracker.advance(end);
+
+    // At midnight, move the finished day into the archive and keep only the new day in memory
+    if (end >= (day + 1) * ms_per_day) {
+        MemScope archive_scope(MemTag::Archive);
+        archive.submit(static_cast<int>(day), move(history), time_series.takeSnapshots());
+        history = ServedHistory();
+        history_day = static_cast<int>(day) + 1;
+        served_patients.clear();
+    }
+}
+
+// With ticks shorter than a minute, the simulation can end part-way through a minute whose
+// activity recordTick has gathered but not yet appended; append it as the last snapshot.
+template <class Policy>
+void Scheduler<Policy>::flushPartialMinute(SimTime now) {
+    if (now % ms_per_minute == 0) return;  // The last tick closed its minute
+    MemScope scope(MemTag::TimeSeries);
+    current.minute = static_cast<int32_t>(now / ms_per_minute);
+    current.urgent_depth = static_cast<int32_t>(waitingCount(true));
+    current.normal_depth = static_cast<int32_t>(waitingCount(false));
+    time_series.append(current);
+    current = QueueSnapshot{};
+}
+
+// Display heap usage per subsystem, scaled by the patients each structure holds
+template <class Policy>
+void Scheduler<Policy>::displayMemory() const {
+    MemoryAccounting::report(cout, static_cast<long long>(waitingCount(true) + waitingCount(false)),
+                             static_cast<long long>(history.size() + archive.residentRecords()));
+}
+
+// Display each department's weight, service and waits, with two fairness measures.
+// A department's fair share is its weighted max-min share of the service actually given:
+// weight-proportional, but never more than it asked for, the surplus going to the others.
+// Share is compared against that, and Jain's index is taken over served / fair share
+// (1.0 = every department got its fair share, 1/n = one department got everything).
+template <class Policy>
+void Scheduler<Policy>::displayDepartments() const {
+    long long total = 0;
+    for (const auto& d : departments) total += d.served;
+
+    // Water-fill the service given across departments in proportion to weight,
+    // capping each at its demand (arrivals) and handing the excess to the rest
+    vector<double> fair(departments.size(), 0.0);
+    vector<bool> capped(departments.size(), false);
+    double remaining = static_cast<double>(total);
+    for (size_t d = 0; d < departments.size(); d++) capped[d] = departments[d].arrivals == 0;
+    for (bool changed = true; changed && remaining > 0;) {
+        changed = false;
+        long long open_weight = 0;
+        for (size_t d = 0; d < departments.size(); d++) if (!capped[d]) open_weight += departments[d].weight;
+        if (open_weight == 0) break;
+        double level = remaining / open_weight;
+        for (size_t d = 0; d < departments.size(); d++) {
+            if (capped[d] || departments[d].arrivals > level * departments[d].weight) continue;
+            fair[d] = static_cast<double>(departments[d].arrivals);
+            remaining -= fair[d];
+            capped[d] = changed = true;
+        }
+        if (!changed) {
+            for (size_t d = 0; d < departments.size(); d++)
+                if (!capped[d]) fair[d] = level * departments[d].weight;
+        }
+    }
+
+    double sum = 0, sum_sq = 0;
+    int competing = 0;
+    for (size_t d = 0; d < departments.size(); d++) {
+        if (fair[d] <= 0) continue;  // Departments nobody came to do not compete for service
+        double normalized = departments[d].served / fair[d];
+        sum += normalized;
+        sum_sq += normalized * normalized;
+        competing++;
+    }
+    cout << "\nDepartments:\n";
+    cout << "Name            Weight  Waiting  Arrived  Served  Expired  AvgWait(min)  Share  FairShare\n";
+    for (size_t i = 0; i < departments.size(); i++) {
+        const auto& d = departments[i];
+        cout << left << setw(16) << d.name << right << setw(6) << d.weight
+             << setw(9) << d.waiting() << setw(9) << d.arrivals << setw(8) << d.served << setw(9) << d.expired
+             << fixed << setprecision(2)
+             << setw(14) << (d.served > 0 ? static_cast<double>(d.waiting_time) / ms_per_minute / d.served : 0.0)
+             << setw(7) << (total > 0 ? static_cast<double>(d.served) / total : 0.0)
+             << setw(11) << (total > 0 ? fair[i] / total : 0.0) << "\n";
+    }
+    if (competing > 0 && sum_sq > 0) {
+        cout << "Jain's fairness index (served per fair share): " << fixed << setprecision(3)
+             << sum * sum / (competing * sum_sq) << "\n";
+    }
+}
+
+// Display the overall simulation statistics
+template <class Policy>
+void Scheduler<Policy>::displayStatistics() {
+    cout << "\nSimulation Summary:\n";
+    cout << "Total Patients: " << total_patients << endl;
+    cout << "Urgent Patients: " << total_urgent << endl;
+    cout << "Normal Patients: " << total_normal << endl;
+    cout << "Total Served Patients: " << total_served << endl;
+
+    // Calculate and display average waiting time
+    if (total_served > 0) {
+        double avg_waiting_time = static_cast<double>(total_waiting_time) / ms_per_minute / total_served;
+        cout << "Average Waiting Time: " << fixed << setprecision(2) << avg_waiting_time << " minutes" << endl;
+    } else {
+        cout << "Average Waiting Time: N/A (no patients served)" << endl;
+    }
+
+    ward.displayStatistics();
+    clinician_pool.displayStatistics();
+    if (departments.size() > 1) displayDepartments();
+    admission.displayStatistics();
+    predictor.displayStatistics(true);
+    predictor.displayStatistics(false);
+    displayDepths();
+
+    // Display a one-line summary of every archived segment
+    for (const auto& segment : archive.snapshot()) {
+        cout << "Archived days " << segment->first_day << "-" << segment->last_day
+             << ": " << segment->counters.arrivals << " arrived, "
+             << segment->counters.served << " served, "
+             << segment->counters.expired << " expired\n";
+    }
+
+    // Display the hourly rollup of queue activity
+    if (!time_series.empty()) {
+        cout << "\nHourly Queue Activity:\n";
+        cout << "Hour  AvgUrgent  AvgNormal  MaxUrgent  MaxNormal  Arrived  Served  Expired\n";
+        for (const auto& h : time_series.hourlyRollup()) {
+            cout << setw(4) << h.start_minute / 60
+                 << setw(11) << fixed << setprecision(1) << static_cast<double>(h.urgent_depth_sum) / h.samples
+                 << setw(11) << static_cast<double>(h.normal_depth_sum) / h.samples
+                 << setw(11) << h.urgent_depth_max
+                 << setw(11) << h.normal_depth_max
+                 << setw(9) << h.urgent_arrivals + h.normal_arrivals
+                 << setw(8) << h.urgent_served + h.normal_served
+                 << setw(9) << h.urgent_expired + h.normal_expired << endl;
+        }
+    }
+}
+
+// Display the depth trackers: hourly and daily high-water marks and time-weighted averages,
+// the time each day spent at each depth, and what the observed peak means for queue memory
+template <class Policy>
+void Scheduler<Policy>::displayDepths() const {
+    const DepthTracker& u = depth_trackers[0];
+    const DepthTracker& n = depth_trackers[1];
+    auto row = [](const string& label, const DepthTracker::DepthPeriod& up, const DepthTracker::DepthPeriod& np) {
+        cout << setw(6) << label << fixed << setprecision(1) << setw(11) << up.average() << setw(11) << up.high_water
+             << setw(11) << np.average() << setw(11) << np.high_water << endl;
+    };
+    cout << "\nQueue Depth (time-weighted):\n";
+    cout << "  Hour  AvgUrgent HighUrgent  AvgNormal HighNormal\n";
+    for (size_t i = 0; i < u.closedHours().size(); i++) {
+        row(to_string(u.closedHours()[i].start_minute / 60), u.closedHours()[i], n.closedHours()[i]);
+    }
+    if (u.currentHour().length > 0) row(to_string(u.currentHour().start_minute / 60) + "*", u.currentHour(), n.currentHour());
+    cout << "   Day  AvgUrgent HighUrgent  AvgNormal HighNormal\n";
+    for (size_t i = 0; i < u.closedDays().size(); i++) {
+        row(to_string(u.closedDays()[i].start_minute / minutes_per_day), u.closedDays()[i], n.closedDays()[i]);
+    }
+    if (u.currentDay().length > 0) row(to_string(u.currentDay().start_minute / minutes_per_day) + "*", u.currentDay(), n.currentDay());
+
+    // Share of each day spent at each depth, for buckets the queues ever reached
+    vector<pair<string, const DepthTracker::DepthPeriod*>> days;
+    for (const DepthTracker* tracker : {&u, &n}) {
+        for (const auto& d : tracker->closedDays()) days.emplace_back(tracker == &u ? "U" : "N", &d);
+        if (tracker->currentDay().length > 0) days.emplace_back(tracker == &u ? "U" : "N", &tracker->currentDay());
+    }
+    cout << "Depth histogram (% of each day; U = urgent, N = normal):\n";
+    for (int b = 0; b < DepthTracker::depth_buckets; b++) {
+        bool reached = false;
+        for (const auto& d : days) reached = reached || d.second->time_at[b] > 0;
+        if (!reached) continue;
+        string range = b < 2 ? to_string(b) : to_string(size_t(1) << (b - 1)) + (b == DepthTracker::depth_buckets - 1 ? "+" : "-" + to_string((size_t(1) << b) - 1));
+        cout << setw(11) << range;
+        for (const auto& d : days) {
+            cout << "  " << d.first << d.second->start_minute / minutes_per_day << " " << setw(5) << setprecision(1)
+                 << 100.0 * d.second->time_at[b] / d.second->length;
+        }
+        cout << endl;
+    }
+
+    // Queue storage at the observed peak: each waiting patient is a queue entry plus its position ticket
+    size_t peak = u.peak() + n.peak();
+    cout << "Peak depth " << u.peak() << " urgent + " << n.peak() << " normal; queue storage at peak about "
+         << (peak * (sizeof(Patient) + sizeof(uint64_t)) + 1023) / 1024 << " KB\n";
+}
+
+// Peak resident set size of the process in kilobytes (0 if unknown)
+long peakRssKb() {
+#ifdef __linux__
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) return usage.ru_maxrss;
+#endif
+    return 0;
+}
+
+// BenchResult: Measurements from one scenario/backlog/thread-count cell
+struct BenchResult {
+    double seconds = 0;              // Wall time for the whole cell
+    long long simulated_minutes = 0; // Summed over all threads
+    long long patients = 0;          // Patients added, summed over all threads
+    vector<double> tick_micros;      // Latency of every tick on every thread
+};
+
+// Run one scenario on a fresh scheduler whose queues are held at `backlog` or more waiting patients.
+// The backlog comes from the compile-time table (repeated if larger), so every run starts identically.
+// It starts spread evenly over the last max_wait minutes of arrivals, so about backlog / (max_wait + 1)
+// of it expires each minute, the steady turnover of a queue that deep, rather than all at once. It is
+// topped up before every tick; top-ups count toward SimMin/s but not tick latency or patients.
+template <class Policy>
+void runScenario(const Scenario& scenario, int backlog, unsigned seed, BenchResult& result) {
+    mt19937 rng(seed);
+    uniform_int_distribution<int> capacity(Policy::min_serve, Policy::max_serve);
+    Scheduler<Policy> scheduler;
+    size_t next_seed = 0;
+    auto topUp = [&](SimTime arrival, int count) {
+        for (int i = 0; i < count; i++) {
+            scheduler.addPatient(benchmark_population[next_seed++ % benchmark_population.size()].toPatient(arrival));
+        }
+    };
+    const int spread = Policy::max_wait + 1;
+    for (int age = spread - 1; age >= 0; age--) {
+        topUp(-age * ms_per_minute, backlog / spread + (age < backlog % spread ? 1 : 0));
+    }
+
+    for (int minute = 0; minute < scenario.minutes; minute++) {
+        SimTime now = minute * ms_per_minute;
+        int depth = static_cast<int>(scheduler.queueDepth(true) + scheduler.queueDepth(false));
+        if (depth < backlog) topUp(now, backlog - depth);
+        vector<Patient> arrivals = BasicPatientGenerator<Policy>::generateArrivals(now, ms_per_minute, rng, scenario.paramsAt(minute));
+        int max_to_serve = capacity(rng);
+        auto start = chrono::steady_clock::now();
+        for (const Patient& p : arrivals) {
+            scheduler.addPatient(p);
+        }
+        scheduler.servePatients(max_to_serve, now);
+        scheduler.recordTick(now);
+        auto end = chrono::steady_clock::now();
+        result.tick_micros.push_back(chrono::duration<double, micro>(end - start).count());
+        result.patients += static_cast<long long>(arrivals.size());
+    }
+    result.simulated_minutes += scenario.minutes;
+}
+
+// CellResult: The figures for one scenario/backlog/thread-count cell
+struct CellResult {
+    double sim_minutes_per_second;
+    double patients_per_second;
+    long peak_rss_kb;
+    double p99_tick_micros;
+};
+
+// Run one cell: each thread drives its own scheduler, so thread count measures how independent runs scale
+template <class Policy>
+CellResult runCell(const Scenario& scenario, int backlog, unsigned threads) {
+    vector<BenchResult> results(threads);
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] { runScenario<Policy>(scenario, backlog, 1000 + t, results[t]); });
+    }
+    for (auto& w : workers) w.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    BenchResult total;
+    for (auto& r : results) {
+        total.simulated_minutes += r.simulated_minutes;
+        total.patients += r.patients;
+        total.tick_micros.insert(total.tick_micros.end(), r.tick_micros.begin(), r.tick_micros.end());
+    }
+    size_t p99 = total.tick_micros.size() * 99 / 100;
+    nth_element(total.tick_micros.begin(), total.tick_micros.begin() + p99, total.tick_micros.end());
+    return CellResult{total.simulated_minutes / seconds, total.patients / seconds, peakRssKb(), total.tick_micros[p99]};
+}
+
+// Whether bench cells run in child processes: not while a profiler is on, since neither the
+// SIGPROF timer nor the counter totals of a child would reach this process's report
+inline bool isolateCells() {
+    return !PerfProfiler::active && !SamplingProfiler::isRunning();
+}
+
+// Run a cell in a child process, so the peak RSS it reports belongs to that cell alone rather than
+// being the high-water mark of every cell so far. Elsewhere, or while profiling, the cell runs in this process.
+template <class Policy>
+CellResult runIsolatedCell(const Scenario& scenario, int backlog, unsigned threads, ostream& out) {
+#ifdef __linux__
+    int fds[2];
+    out.flush();
+    if (isolateCells() && pipe(fds) == 0) {
+        pid_t child = fork();
+        if (child == 0) {
+            close(fds[0]);
+            CellResult result = runCell<Policy>(scenario, backlog, threads);
+            ssize_t sent = write(fds[1], &result, sizeof(result));
+            _exit(sent == static_cast<ssize_t>(sizeof(result)) ? 0 : 1);
+        }
+        close(fds[1]);
+        if (child > 0) {
+            CellResult result;
+            ssize_t got = read(fds[0], &result, sizeof(result));
+            close(fds[0]);
+            waitpid(child, nullptr, 0);
+            if (got != static_cast<ssize_t>(sizeof(result))) throw runtime_error("Benchmark cell process failed.");
+            return result;
+        }
+        close(fds[0]);
+    }
+#else
+    (void)out;
+#endif
+    return runCell<Policy>(scenario, backlog, threads);
+}
+
+// Run every standard scenario across queue depths and thread counts and print one row per cell
+template <class Policy>
+void runBenchmarks(ostream& out) {
+    const int backlogs[] = {0, 1000, 100000};
+    vector<unsigned> thread_counts = {1, 2, 4};
+    unsigned hardware = thread::hardware_concurrency();
+    if (hardware > 4) thread_counts.push_back(hardware);
+
+    out << "Scenario        Backlog Threads   SimMin/s    Patients/s  PeakRSS(KB)  p99Tick(us)\n";
+    for (const Scenario& scenario : standard_scenarios) {
+        for (int backlog : backlogs) {
+            for (unsigned threads : thread_counts) {
+                CellResult cell = runIsolatedCell<Policy>(scenario, backlog, threads, out);
+                out << left << setw(16) << scenario.name << right << setw(7) << backlog << setw(8) << threads
+                    << fixed << setprecision(0)
+                    << setw(11) << cell.sim_minutes_per_second
+                    << setw(14) << cell.patients_per_second
+                    << setw(13) << cell.peak_rss_kb
+                    << setprecision(1) << setw(13) << cell.p99_tick_micros << "\n";
+            }
+        }
+    }
+    out << "(Queues are held at the backlog depth; Patients/s counts scenario arrivals, not top-ups.\n"
+        << (isolateCells() ? " PeakRSS is the peak of the process that ran the cell, a fresh copy of this one.)\n"
+                           : " Profiling keeps every cell in this process, so PeakRSS is its peak over the cells so far.)\n");
+}
+
+// ReplicationBatch Class: Runs `Lanes` independent copies of the two-queue model in lockstep.
+// A copy keeps only counters: patients still waiting are counted by arrival minute in a ring of
+// max_wait + 1 slots, which is all FIFO serving and expiry need when patients are interchangeable.
+// Every array is stored lane-innermost, so each step is a few fixed-length loops over lanes that
+// the compiler turns into SIMD instructions. All lanes follow the same scenario but draw from
+// their own xorshift generator.
+template <class Policy = DefaultPolicy, int Lanes = 16>
+class ReplicationBatch {
+public:
+    static const int window = Policy::max_wait + 1;  // Arrival minutes a patient can still be served in
+
+    // LaneTotals: What one replication saw over the whole run
+    struct LaneTotals {
+        int64_t arrived = 0;
+        int64_t urgent_served = 0, normal_served = 0;
+        int64_t urgent_expired = 0, normal_expired = 0;
+        int64_t wait_minutes = 0;  // Summed over served patients
+
+        int64_t served() const { return urgent_served + normal_served; }
+        int64_t expired() const { return urgent_expired + normal_expired; }
+        double averageWait() const { return served() > 0 ? static_cast<double>(wait_minutes) / served() : 0; }
+    };
+
+private:
+    uint32_t rng[Lanes];
+    int32_t urgent_ring[window][Lanes] = {};  // Patients still waiting, by arrival minute mod window
+    int32_t normal_ring[window][Lanes] = {};
+    int64_t arrived[Lanes] = {};
+    int64_t urgent_served[Lanes] = {}, normal_served[Lanes] = {};
+    int64_t urgent_expired[Lanes] = {}, normal_expired[Lanes] = {};
+    int64_t wait_minutes[Lanes] = {};
+
+    // Advance every lane's xorshift32 state and return uniforms in (0, 1)
+    void uniforms(float (&u)[Lanes]) {
+        for (int l = 0; l < Lanes; l++) {
+            uint32_t x = rng[l];
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            rng[l] = x;
+            u[l] = (static_cast<int32_t>(x >> 8) + 0.5f) * (1.0f / 16777216.0f);
+        }
+    }
+
+    // Draw a Poisson count with the given mean in every lane. Knuth's product method with a fixed
+    // iteration count: a lane stops counting once its product falls below e^-mean, so there are no
+    // per-lane branches. The bound leaves out only the far tail of the distribution. Floats keep
+    // the lanes as wide as the int32 counters; means too large for e^-mean to be a normal float are
+    // drawn as a sum of smaller Poisson counts.
+    void poisson(double mean, int32_t (&count)[Lanes]) {
+        const double max_part = 60;
+        for (int l = 0; l < Lanes; l++) count[l] = 0;
+        for (; mean > 0; mean -= max_part) {
+            double part = min(mean, max_part);
+            float limit = static_cast<float>(std::exp(-part));
+            int rounds = static_cast<int>(part + 6 * std::sqrt(part) + 6);
+            float product[Lanes], u[Lanes];
+            for (int l = 0; l < Lanes; l++) product[l] = 1;
+            for (int r = 0; r < rounds; r++) {
+                uniforms(u);
+                for (int l = 0; l < Lanes; l++) {
+                    product[l] *= u[l];
+                    count[l] += product[l] > limit;
+                }
+            }
+        }
+    }
+
+    // Serve oldest arrivals first from one queue's ring, using up each lane's remaining capacity
+    void serveRing(int32_t (&ring)[window][Lanes], int minute, int32_t (&room)[Lanes], int64_t (&served)[Lanes]) {
+        for (int age = window - 1; age >= 0; age--) {
+            int32_t (&bucket)[Lanes] = ring[(minute - age + window) % window];
+            for (int l = 0; l < Lanes; l++) {
+                int32_t take = min(bucket[l], room[l]);
+                bucket[l] -= take;
+                room[l] -= take;
+                served[l] += take;
+                wait_minutes[l] += static_cast<int64_t>(take) * age;
+            }
+        }
+    }
+
+public:
+    explicit ReplicationBatch(uint64_t seed) {
+        SplitMix64 seeder(seed);
+        for (int l = 0; l < Lanes; l++) {
+            rng[l] = static_cast<uint32_t>(seeder()) | 1;  // xorshift state must be non-zero
+        }
+    }
+
+    // Simulate one minute in every lane: expire, take arrivals, then serve urgent before normal,
+    // in the same order as Scheduler::servePatients
+    void step(int minute, const GeneratorParams& params) {
+        int slot = minute % window;
+
+        // Patients who arrived `window` minutes ago have now waited longer than max_wait
+        for (int l = 0; l < Lanes; l++) {
+            urgent_expired[l] += urgent_ring[slot][l];
+            normal_expired[l] += normal_ring[slot][l];
+        }
+
+        // Urgent and normal arrivals are independent Poisson streams that split the total rate
+        int32_t urgent[Lanes], normal[Lanes];
+        poisson(params.arrivals_per_minute * params.urgent_fraction, urgent);
+        poisson(params.arrivals_per_minute * (1 - params.urgent_fraction), normal);
+        for (int l = 0; l < Lanes; l++) {
+            urgent_ring[slot][l] = urgent[l];
+            normal_ring[slot][l] = normal[l];
+            arrived[l] += urgent[l] + normal[l];
+        }
+
+        // Service capacity is uniform in [min_serve, max_serve], as drawServiceCapacity draws it
+        int32_t room[Lanes];
+        const uint64_t range = Policy::max_serve - Policy::min_serve + 1;
+        for (int l = 0; l < Lanes; l++) {
+            uint32_t x = rng[l];
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            rng[l] = x;
+            room[l] = Policy::min_serve + static_cast<int32_t>((x * range) >> 32);
+        }
+
+        serveRing(urgent_ring, minute, room, urgent_served);
+        serveRing(normal_ring, minute, room, normal_served);
+    }
+
+    LaneTotals totals(int lane) const {
+        LaneTotals t;
+        t.arrived = arrived[lane];
+        t.urgent_served = urgent_served[lane];
+        t.normal_served = normal_served[lane];
+        t.urgent_expired = urgent_expired[lane];
+        t.normal_expired = normal_expired[lane];
+        t.wait_minutes = wait_minutes[lane];
+        return t;
+    }
+};
+
+// Run `replications` independent copies of a scenario, `Lanes` at a time per batch, spreading
+// batches over `threads` workers. Returns the totals of every replication, in seed order.
+template <class Policy, int Lanes>
+vector<typename ReplicationBatch<Policy, Lanes>::LaneTotals> runReplications(const Scenario& scenario, int replications, unsigned threads) {
+    typedef ReplicationBatch<Policy, Lanes> Batch;
+    int batches = (replications + Lanes - 1) / Lanes;
+    vector<typename Batch::LaneTotals> results(static_cast<size_t>(batches) * Lanes);
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            for (int b = static_cast<int>(t); b < batches; b += static_cast<int>(threads)) {
+                Batch batch(0x5EED0000ULL + static_cast<uint64_t>(b));
+                for (int minute = 0; minute < scenario.minutes; minute++) {
+                    batch.step(minute, scenario.paramsAt(minute));
+                }
+                for (int l = 0; l < Lanes; l++) {
+                    results[static_cast<size_t>(b) * Lanes + l] = batch.totals(l);
+                }
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+    results.resize(replications);
+    return results;
+}
+
+// Monte Carlo study of every standard scenario: mean and 95% confidence half-width of the outcome
+// of each replication, plus replication throughput for one lane and for a full SIMD batch
+template <class Policy>
+void runReplicationStudy(ostream& out, int replications) {
+    const int lanes = 16;
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    auto mean_ci = [&](const vector<double>& values) {
+        double sum = 0, sum_sq = 0;
+        for (double v : values) { sum += v; sum_sq += v * v; }
+        double mean = sum / values.size();
+        double variance = values.size() > 1 ? (sum_sq - sum * mean) / (values.size() - 1) : 0;
+        return make_pair(mean, 1.96 * std::sqrt(max(0.0, variance) / values.size()));
+    };
+
+    out << replications << " replications per scenario on " << threads << " thread(s)\n";
+    out << "Scenario        Served            Expired           AvgWait(min)    RepMin/s(1 lane) RepMin/s(" << lanes << " lanes)\n";
+    for (const Scenario& scenario : standard_scenarios) {
+        auto start = chrono::steady_clock::now();
+        runReplications<Policy, 1>(scenario, replications, threads);
+        double scalar_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        start = chrono::steady_clock::now();
+        auto results = runReplications<Policy, lanes>(scenario, replications, threads);
+        double simd_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        vector<double> served, expired, waits;
+        for (const auto& r : results) {
+            served.push_back(static_cast<double>(r.served()));
+            expired.push_back(static_cast<double>(r.expired()));
+            waits.push_back(r.averageWait());
+        }
+        auto s = mean_ci(served), e = mean_ci(expired), w = mean_ci(waits);
+        double rep_minutes = static_cast<double>(replications) * scenario.minutes;
+        out << left << setw(16) << scenario.name << right << fixed
+            << setprecision(1) << setw(9) << s.first << " +-" << setw(6) << s.second
+            << setprecision(1) << setw(9) << e.first << " +-" << setw(6) << e.second
+            << setprecision(2) << setw(8) << w.first << " +-" << setw(5) << w.second
+            << setprecision(0) << setw(17) << rep_minutes / scalar_seconds
+            << setw(17) << rep_minutes / simd_seconds << "\n";
+    }
+}
+
+// Write `count` generated patients to a dataset file, following a scenario's arrival model
+// (repeated for as long as it takes). Time is cut into blocks of minutes, each filled by a
+// worker thread from an engine seeded by the block number, so the file depends only on the
+// seed and not on the thread count. The main thread writes each round of finished blocks in
+// order, one large write per block, while the workers fill the next round.
+template <class Policy>
+bool generateDataset(const string& path, uint64_t count, const Scenario& scenario, uint64_t seed, ostream& out) {
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file) {
+        out << "Could not open " << path << " for writing.\n";
+        return false;
+    }
+    PatientFileHeader header = {};
+    memcpy(header.magic, PatientFileHeader::expected_magic, sizeof(header.magic));
+    header.version = 1;
+    header.record_size = sizeof(PatientRecord);
+    header.seed = seed;
+    strncpy(header.scenario, scenario.name, sizeof(header.scenario) - 1);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));  // Rewritten with the totals at the end
+
+    // About a million records per block at the scenario's base rate, fewer for small files
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    double rate = max(scenario.base.arrivals_per_minute, 0.01);
+    const int64_t block_minutes = max<int64_t>(1, static_cast<int64_t>(min((1 << 20) / rate, count / rate / threads + 1)));
+    auto fill = [&](int64_t block, vector<PatientRecord>& records) {
+        records.clear();
+        SplitMix64 seeder(seed ^ (static_cast<uint64_t>(block) * 0x9E3779B97F4A7C15ULL));
+        mt19937_64 rng(seeder());
+        vector<SimTime> offsets;
+        for (int64_t minute = block * block_minutes; minute < (block + 1) * block_minutes; minute++) {
+            const GeneratorParams& params = scenario.paramsAt(static_cast<int>(minute % scenario.minutes));
+            if (params.arrivals_per_minute <= 0) continue;
+            poisson_distribution<int> arrivals(params.arrivals_per_minute);
+            offsets.resize(arrivals(rng));
+            for (SimTime& offset : offsets) offset = static_cast<SimTime>(rng() % ms_per_minute);
+            sort(offsets.begin(), offsets.end());  // Records are kept in arrival order
+            for (SimTime offset : offsets) {
+                records.push_back(BasicPatientGenerator<Policy>::generateRecord(minute * ms_per_minute + offset, rng, params));
+            }
+        }
+    };
+
+    vector<vector<PatientRecord>> filling(threads), ready(threads);
+    int64_t next_block = 0;
+    auto launch = [&] {
+        vector<thread> workers;
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back(fill, next_block + t, ref(filling[t]));
+        }
+        next_block += threads;
+        return workers;
+    };
+
+    auto start = chrono::steady_clock::now();
+    uint64_t written = 0;
+    vector<thread> workers = launch();
+    while (written < count && file) {
+        for (auto& w : workers) w.join();
+        swap(filling, ready);
+        workers = launch();  // Generate the next round while this one is written
+        for (const auto& block : ready) {
+            size_t n = static_cast<size_t>(min<uint64_t>(block.size(), count - written));
+            if (n == 0) continue;
+            if (written == 0) header.first_arrival = block.front().arrival;
+            header.last_arrival = block[n - 1].arrival;
+            file.write(reinterpret_cast<const char*>(block.data()), static_cast<streamsize>(n * sizeof(PatientRecord)));
+            written += n;
+        }
+    }
+    for (auto& w : workers) w.join();
+
+    header.record_count = written;
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+    if (!file) {
+        out << "Error writing " << path << ".\n";
+        return false;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double megabytes = (sizeof(header) + written * sizeof(PatientRecord)) / 1048576.0;
+    out << "Wrote " << written << " patients (" << fixed << setprecision(1) << megabytes << " MB) to " << path
+        << " in " << setprecision(2) << seconds << " s: " << setprecision(0) << written / seconds << " records/s, "
+        << setprecision(1) << megabytes / seconds << " MB/s on " << threads << " thread(s)\n";
+    return true;
+}
+
+// PatientFile Class: Read-only view of a dataset file. On Linux the records are mapped
+// into memory and used in place; elsewhere they are read in with one large read.
+class PatientFile {
+    PatientFileHeader header = {};
+    const PatientRecord* records = nullptr;
+    vector<PatientRecord> loaded;   // Record storage when the file is not mapped
+#ifdef __linux__
+    void* mapping = MAP_FAILED;
+    size_t mapping_size = 0;
+#endif
+
+public:
+    explicit PatientFile(const string& path) {
+        ifstream file(path, ios::binary | ios::ate);
+        if (!file) throw runtime_error("Could not open " + path + ".");
+        uint64_t file_size = static_cast<uint64_t>(file.tellg());
+        file.seekg(0);
+        if (file_size < sizeof(header) || !file.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || memcmp(header.magic, PatientFileHeader::expected_magic, sizeof(header.magic)) != 0) {
+            throw runtime_error(path + " is not a patient dataset file.");
+        }
+        if (header.version != 1 || header.record_size != sizeof(PatientRecord)) {
+            throw runtime_error(path + " has an unsupported format version.");
+        }
+        if (file_size < sizeof(header) + header.record_count * sizeof(PatientRecord)) {
+            throw runtime_error(path + " is truncated.");
+        }
+        if (header.record_count == 0) return;
+#ifdef __linux__
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            mapping_size = sizeof(header) + header.record_count * sizeof(PatientRecord);
+            mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (mapping != MAP_FAILED) {
+                madvise(mapping, mapping_size, MADV_SEQUENTIAL);  // Replay reads front to back
+                records = reinterpret_cast<const PatientRecord*>(static_cast<const char*>(mapping) + sizeof(header));
+                return;
+            }
+        }
+#endif
+        loaded.resize(header.record_count);
+        if (!file.read(reinterpret_cast<char*>(loaded.data()), static_cast<streamsize>(loaded.size() * sizeof(PatientRecord)))) {
+            throw runtime_error("Could not read " + path + ".");
+        }
+        records = loaded.data();
+    }
 
-public:
-    // Constructor to initialize patient details
-    Patient(string id, char gender, string time, string type, int arrival_minute)
-        : id(id), gender(gender), arrival_time(time), type(type), arrival_minute(arrival_minute) {}
+    ~PatientFile() {
+#ifdef __linux__
+        if (mapping != MAP_FAILED) munmap(mapping, mapping_size);
+#endif
+    }
+    PatientFile(const PatientFile&) = delete;
+    PatientFile& operator=(const PatientFile&) = delete;
 
-    // Getters for patient attributes
-    string getId() const { return id; }
-    char getGender() const { return gender; }
-    string getArrivalTime() const { return arrival_time; }
-    string getType() const { return type; }
-    int getArrivalMinute() const { return arrival_minute; }
+    const PatientFileHeader& info() const { return header; }
+    size_t size() const { return static_cast<size_t>(header.record_count); }
+    const PatientRecord& operator[](size_t i) const { return records[i]; }
 };
 
-// PatientGenerator Class: Generates random patient data for simulation
-class PatientGenerator {
-public:
-    // Generate a random patient at a given minute
-    static Patient generateRandomPatient(int minute) {
-        // Random 14-digit ID starting with 2 or 3
-        int first_digit = rand() % 2 + 2;  // Randomly select between 2 and 3
-        string id = to_string(first_digit);  // Start the ID with 2 or 3
+// CsvRow: One parsed CSV line, before arrival times are resolved in file order
+struct CsvRow {
+    PatientRecord record;
+    bool has_arrival;      // False when the arrival_ms column was empty
+    size_t line;           // Line within its chunk, from 0
+};
 
-        // Generate the remaining 13 digits
-        for (int i = 0; i < 13; i++) {
-            id += to_string(rand() % 10);  // Append random digits (0-9)
-        }
+// CsvChunk: A block of whole CSV lines and what parsing it produced
+struct CsvChunk {
+    string text;
+    vector<CsvRow> rows;
+    vector<pair<size_t, string>> rejects;  // Line within the chunk (from 0) and reason
+    size_t lines = 0;
+};
 
-        char gender = (rand() % 2 == 0) ? 'M' : 'F';  // Random gender (M or F)
-        string arrival_time = to_string(rand() % 24) + ":" + to_string(rand() % 60);  // Random time in HH:MM format
-        string type = (rand() % 2 == 0) ? "Urgent" : "Normal";  // Random type ("Urgent" or "Normal")
+// Columns of the dataset CSV: the manual input fields first, then the optional ones
+const char* const dataset_csv_header = "id,gender,arrival_time,type,skills,department,arrival_ms";
 
-        return Patient(id, gender, arrival_time, type, minute);  // Return the generated patient
+// Parse one CSV line into a record; returns an error message, or an empty string on success.
+// Skills are '|'-separated names; empty optional columns take their defaults.
+string parseCsvRow(const char* begin, const char* end, CsvRow& row) {
+    const char* fields[7];
+    size_t lengths[7];
+    int count = 0;
+    for (const char* p = begin;; p++) {
+        if (p == end || *p == ',') {
+            if (count == 7) return "too many columns";
+            fields[count] = begin;
+            lengths[count++] = static_cast<size_t>(p - begin);
+            if (p == end) break;
+            begin = p + 1;
+        }
     }
+    if (count < 4) return "expected at least 4 columns";
+    while (count < 7) lengths[count++] = 0;
 
-    // Generate a list of patients given a count and start time
-    static vector<Patient> generatePatients(int count, int start_minute) {
-        vector<Patient> patients;
-        for (int i = 0; i < count; i++) {
-            patients.push_back(generateRandomPatient(start_minute));  // Add each random patient to the list
+    PatientRecord& r = row.record;
+    r = PatientRecord{};
+    if (lengths[0] == 0 || lengths[0] > sizeof(r.id)) return "ID must be 1 to 14 characters";
+    memcpy(r.id, fields[0], lengths[0]);
+
+    if (lengths[1] != 1 || (toupper(fields[1][0]) != 'M' && toupper(fields[1][0]) != 'F')) return "gender must be M or F";
+    r.gender = static_cast<char>(toupper(fields[1][0]));
+
+    const char* t = fields[2];
+    size_t colon = find(t, t + lengths[2], ':') - t;
+    auto digits = [](const char* from, size_t n, int& value) {
+        if (n == 0 || n > 2) return false;
+        value = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (from[i] < '0' || from[i] > '9') return false;
+            value = value * 10 + (from[i] - '0');
         }
-        return patients;
+        return true;
+    };
+    int hour, minute;
+    if (colon == lengths[2] || !digits(t, colon, hour) || !digits(t + colon + 1, lengths[2] - colon - 1, minute)
+        || hour > 23 || minute > 59) {
+        return "arrival time must be HH:MM";
     }
-};
+    r.clock = static_cast<uint16_t>(hour * 60 + minute);
 
-// Scheduler Class: Handles the queuing and serving of patients
-class Scheduler {
-    queue<Patient> urgent_queue;        // Queue for urgent patients
-    queue<Patient> normal_queue;        // Queue for normal patients
-    vector<Patient> served_patients;    // List of patients who have been served
-    int total_patients = 0;             // Total number of patients in the system
-    int total_urgent = 0;               // Count of urgent patients
-    int total_normal = 0;               // Count of normal patients
-    int total_waiting_time = 0;         // Total waiting time for served patients
-    int total_served = 0;               // Total number of patients served
+    string type(fields[3], lengths[3]);
+    for (char& c : type) c = static_cast<char>(toupper(c));
+    if (type != "URGENT" && type != "NORMAL") return "type must be Urgent or Normal";
+    r.urgent = type == "URGENT" ? 1 : 0;
 
-public:
-    void addPatient(const Patient& patient);   // Add patient to the appropriate queue
-    void servePatients(int max_to_serve, int minute);  // Serve patients based on available slots
-    void displayQueues();                    // Display current state of queues
-    void displayStatistics();                // Display simulation statistics
-    bool isUrgentQueueEmpty() const { return urgent_queue.empty(); }  // Check if the urgent queue is empty
-    bool isNormalQueueEmpty() const { return normal_queue.empty(); }  // Check if the normal queue is empty
-};
+    if (lengths[4] > 0) {
+        string skills(fields[4], lengths[4]);
+        replace(skills.begin(), skills.end(), '|', ',');
+        try {
+            r.skills = parseSkills(skills);
+        } catch (const invalid_argument& e) {
+            return e.what();
+        }
+    }
 
-// Add a patient to the correct queue based on their type
-void Scheduler::addPatient(const Patient& patient) {
-    if (patient.getType() == "Urgent") {
-        urgent_queue.push(patient);   // Add to urgent queue
-        total_urgent++;
-    } else {
-        normal_queue.push(patient);   // Add to normal queue
-        total_normal++;
+    auto number = [](const char* from, size_t n, uint64_t limit, uint64_t& value) {
+        if (n == 0 || n > 19) return false;
+        value = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (from[i] < '0' || from[i] > '9') return false;
+            value = value * 10 + static_cast<uint64_t>(from[i] - '0');
+        }
+        return value <= limit;
+    };
+    uint64_t value = 0;
+    if (lengths[5] > 0) {
+        if (!number(fields[5], lengths[5], UINT16_MAX, value)) return "department must be a number up to 65535";
+        r.department = static_cast<uint16_t>(value);
     }
-    total_patients++;  // Increment total patients count
+    row.has_arrival = lengths[6] > 0;
+    if (row.has_arrival) {
+        if (!number(fields[6], lengths[6], INT64_MAX, value)) return "arrival_ms must be a non-negative number";
+        r.arrival = static_cast<int64_t>(value);
+    }
+    return "";
 }
 
-// Serve patients with priority given to urgent cases
-void Scheduler::servePatients(int max_to_serve, int minute) {
-    int served = 0;
+// Parse every line of a chunk of whole lines
+void parseCsvChunk(CsvChunk& chunk) {
+    chunk.rows.clear();
+    chunk.rejects.clear();
+    chunk.lines = 0;
+    const char* p = chunk.text.data();
+    const char* end = p + chunk.text.size();
+    while (p < end) {
+        const char* eol = find(p, end, '\n');
+        const char* line_end = eol;
+        if (line_end > p && line_end[-1] == '\r') line_end--;
+        if (line_end > p) {
+            CsvRow row;
+            row.line = chunk.lines;
+            string error = parseCsvRow(p, line_end, row);
+            if (error.empty()) chunk.rows.push_back(row);
+            else chunk.rejects.emplace_back(chunk.lines, error);
+        }
+        chunk.lines++;
+        p = eol == end ? end : eol + 1;
+    }
+}
 
-    // Serve urgent patients first
-    while (served < max_to_serve && !urgent_queue.empty()) {
-        try {
-            if (!urgent_queue.empty()) {
-                Patient p = urgent_queue.front();
-                urgent_queue.pop();  // Remove the patient from the queue
+// Convert a CSV export into a dataset file. The input is read in large chunks cut at line
+// boundaries, and a round of chunks is parsed in parallel. The main thread then handles the
+// rows in file order. Rows without arrival_ms arrive at their HH:MM on the current day, and a
+// clock earlier than the previous row's starts the next day. Rows that would break arrival
+// order are rejected, as are malformed rows; the first few rejects are listed by line.
+bool convertCsvToDataset(const string& in_path, const string& out_path, ostream& out) {
+    ifstream in(in_path, ios::binary);
+    ofstream file(out_path, ios::binary | ios::trunc);
+    if (!in || !file) {
+        out << "Could not open " << (in ? out_path : in_path) << ".\n";
+        return false;
+    }
+    PatientFileHeader header = {};
+    memcpy(header.magic, PatientFileHeader::expected_magic, sizeof(header.magic));
+    header.version = 1;
+    header.record_size = sizeof(PatientRecord);
+    strncpy(header.scenario, "csv", sizeof(header.scenario) - 1);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
 
-                // Calculate the waiting time for the patient
-                int waiting_time = minute - p.getArrivalMinute();
-                
-                if (waiting_time > 10) {
-                    // Skip serving if the patient has been waiting too long (more than 10 minutes)
+    const size_t chunk_bytes = 16 << 20;
+    const size_t max_listed = 20;
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    vector<CsvChunk> chunks(threads);
+    string carry;                       // Partial last line of the previous read
+    size_t line_base = 1;               // File line number of the next chunk's first line
+    uint64_t written = 0, rejected = 0;
+    int64_t day = 0, last_arrival = INT64_MIN;
+    int last_clock = -1;
+    vector<PatientRecord> batch;
+    auto start = chrono::steady_clock::now();
+
+    while (in || !carry.empty()) {
+        // Read one chunk per worker, each ending at a line boundary
+        size_t filled = 0;
+        for (; filled < threads && (in || !carry.empty()); filled++) {
+            string& text = chunks[filled].text;
+            text.swap(carry);
+            carry.clear();
+            size_t old_size = text.size();
+            text.resize(old_size + chunk_bytes);
+            in.read(&text[old_size], static_cast<streamsize>(chunk_bytes));
+            text.resize(old_size + static_cast<size_t>(in.gcount()));
+            size_t cut = text.rfind('\n');
+            if (in && cut != string::npos) {
+                carry.assign(text, cut + 1, string::npos);
+                text.resize(cut + 1);
+            }
+        }
+        vector<thread> workers;
+        for (size_t c = 0; c < filled; c++) workers.emplace_back(parseCsvChunk, ref(chunks[c]));
+        for (auto& w : workers) w.join();
+
+        for (size_t c = 0; c < filled; c++) {
+            CsvChunk& chunk = chunks[c];
+            auto report = [&](size_t line, const string& reason) {
+                if (rejected++ < max_listed) out << "  line " << line << ": " << reason << "\n";
+            };
+            bool has_header = line_base == 1 && chunk.text.compare(0, 3, "id,") == 0;
+            size_t reject = has_header && !chunk.rejects.empty() && chunk.rejects[0].first == 0 ? 1 : 0;
+            batch.clear();
+            // Rows and rejects are each in line order; merge them so rejects are listed in file order
+            for (CsvRow& r : chunk.rows) {
+                for (; reject < chunk.rejects.size() && chunk.rejects[reject].first < r.line; reject++) {
+                    report(line_base + chunk.rejects[reject].first, chunk.rejects[reject].second);
+                }
+                // Work out the row's day and arrival first; a rejected row must not move them on
+                int64_t row_day = day;
+                if (!r.has_arrival) {
+                    if (r.record.clock < last_clock) row_day++;
+                    r.record.arrival = row_day * ms_per_day + r.record.clock * ms_per_minute;
+                } else {
+                    row_day = r.record.arrival / ms_per_day;
+                }
+                if (r.record.arrival < last_arrival) {
+                    report(line_base + r.line, "arrival before the previous row");
                     continue;
                 }
+                day = row_day;
+                last_clock = r.record.clock;
+                last_arrival = r.record.arrival;
+                batch.push_back(r.record);
+            }
+            for (; reject < chunk.rejects.size(); reject++) {
+                report(line_base + chunk.rejects[reject].first, chunk.rejects[reject].second);
+            }
+            if (!batch.empty()) {
+                if (written == 0) header.first_arrival = batch.front().arrival;
+                header.last_arrival = batch.back().arrival;
+                file.write(reinterpret_cast<const char*>(batch.data()), static_cast<streamsize>(batch.size() * sizeof(PatientRecord)));
+                written += batch.size();
+            }
+            line_base += chunk.lines;
+        }
+    }
 
-                served_patients.push_back(p);  // Add patient to served list
-                total_waiting_time += waiting_time;  // Add waiting time to the total
-                served++;  // Increment the number of patients served
-            } else {
-                throw runtime_error("Urgent queue is empty!");  // Error if urgent queue is empty
+    header.record_count = written;
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+    if (!file) {
+        out << "Error writing " << out_path << ".\n";
+        return false;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (rejected > max_listed) out << "  ... " << rejected - max_listed << " more\n";
+    out << "Converted " << written << " rows to " << out_path << ", rejected " << rejected << ", in "
+        << fixed << setprecision(2) << seconds << " s (" << setprecision(0) << (written + rejected) / max(seconds, 1e-9)
+        << " rows/s on " << threads << " thread(s))\n";
+    return true;
+}
+
+// Format one record as a CSV line in dataset_csv_header's column order
+void appendCsvRow(const PatientRecord& r, string& out) {
+    out.append(r.id, find(r.id, r.id + sizeof(r.id), '\0') - r.id);
+    out += ',';
+    out += r.gender;
+    out += ',';
+    char clock[8];
+    snprintf(clock, sizeof(clock), "%02d:%02d", r.clock / 60, r.clock % 60);
+    out += clock;
+    out += r.urgent ? ",Urgent," : ",Normal,";
+    if (r.skills) {
+        string skills = formatSkills(r.skills);
+        replace(skills.begin(), skills.end(), ',', '|');
+        out += skills;
+    }
+    out += ',';
+    out += to_string(r.department);
+    out += ',';
+    out += to_string(r.arrival);
+    out += '\n';
+}
+
+// Convert a dataset file back to CSV: slices of records are formatted in parallel and written in order
+bool convertDatasetToCsv(const string& in_path, const string& out_path, ostream& out) {
+    auto start = chrono::steady_clock::now();
+    PatientFile dataset(in_path);
+    ofstream file(out_path, ios::binary | ios::trunc);
+    if (!file) {
+        out << "Could not open " << out_path << ".\n";
+        return false;
+    }
+    file << dataset_csv_header << "\n";
+    const size_t slice = 1 << 18;
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    vector<string> texts(threads);
+    for (size_t first = 0; first < dataset.size(); first += slice * threads) {
+        vector<thread> workers;
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                texts[t].clear();
+                size_t from = first + t * slice, to = min(dataset.size(), from + slice);
+                for (size_t i = from; i < to; i++) appendCsvRow(dataset[i], texts[t]);
+            });
+        }
+        for (auto& w : workers) w.join();
+        for (const string& text : texts) file.write(text.data(), static_cast<streamsize>(text.size()));
+    }
+    file.close();
+    if (!file) {
+        out << "Error writing " << out_path << ".\n";
+        return false;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    out << "Converted " << dataset.size() << " records to " << out_path << " in " << fixed << setprecision(2)
+        << seconds << " s\n";
+    return true;
+}
+
+// Convert between CSV and the dataset format, choosing the direction from the input's contents
+bool convertDataset(const string& in_path, const string& out_path, ostream& out) {
+    ifstream probe(in_path, ios::binary);
+    char magic[sizeof(PatientFileHeader::expected_magic)] = {};
+    probe.read(magic, sizeof(magic));
+    if (!probe && probe.gcount() == 0 && !probe.eof()) {
+        out << "Could not open " << in_path << ".\n";
+        return false;
+    }
+    try {
+        if (memcmp(magic, PatientFileHeader::expected_magic, sizeof(magic)) == 0) {
+            return convertDatasetToCsv(in_path, out_path, out);
+        }
+        return convertCsvToDataset(in_path, out_path, out);
+    } catch (const exception& e) {
+        out << e.what() << "\n";
+        return false;
+    }
+}
+
+// Format a simulation minute as an HH:MM clock time
+string formatClock(int64_t minute) {
+    ostringstream out;
+    out << setfill('0') << setw(2) << minute / 60 % 24 << ":" << setw(2) << minute % 60;
+    return out.str();
+}
+
+// Format a simulation time as HH:MM:SS (with milliseconds when they are not zero)
+string formatTime(SimTime t) {
+    ostringstream out;
+    out << formatClock(t / ms_per_minute) << ":" << setfill('0') << setw(2) << t / ms_per_second % 60;
+    if (t % ms_per_second != 0) out << "." << setw(3) << t % ms_per_second;
+    return out.str();
+}
+
+// DashboardSnapshot: Everything the dashboard shows, published by the simulation as one immutable value
+struct DashboardSnapshot {
+    SimTime now = 0;
+    size_t urgent_depth = 0, normal_depth = 0;
+    size_t intake_depth = 0, deferred = 0;
+    long long arrived = 0, served = 0;
+    double served_per_minute = 0;     // Over the last hour of simulated time
+    vector<int> depth_history;        // Total depth at recent publishes, oldest first
+    vector<SimTime> recent_waits;     // Waits of the most recently served patients
+    vector<string> events;            // Recent events, oldest first
+    bool finished = false;
+};
+
+// Dashboard Class: ANSI terminal dashboard drawn by its own thread at a fixed frame rate.
+// The simulation publishes a snapshot whenever it likes, which only swaps a pointer under
+// a short lock; the render thread draws the latest snapshot, so a slow terminal delays
+// frames but never the scheduling thread.
+class Dashboard {
+    ostream& out;
+    double fps;
+    mutable mutex lock;                          // Guards the fields below
+    condition_variable wake;                     // Signals shutdown
+    shared_ptr<const DashboardSnapshot> latest;
+    bool stopping = false;
+    thread renderer;
+
+    // Bar of `value` out of `scale` in `width` characters
+    static string bar(double value, double scale, int width) {
+        int filled = scale > 0 ? static_cast<int>(min(1.0, value / scale) * width + 0.5) : 0;
+        return string(filled, '#') + string(width - filled, '.');
+    }
+
+    static void render(const DashboardSnapshot& s, ostream& frame) {
+        const char* bold = "\x1b[1m";
+        const char* red = "\x1b[31m";
+        const char* reset = "\x1b[0m";
+        frame << "\x1b[H\x1b[2J";  // Home and clear
+        frame << bold << "Patient Scheduling System" << reset << "   time " << formatTime(s.now)
+              << (s.finished ? "   (finished)" : "") << "\n\n";
+
+        size_t scale = max<size_t>(50, max(s.urgent_depth, s.normal_depth));
+        frame << "Urgent queue " << setw(7) << s.urgent_depth << "  " << red << bar(static_cast<double>(s.urgent_depth), static_cast<double>(scale), 40) << reset << "\n";
+        frame << "Normal queue " << setw(7) << s.normal_depth << "  " << bar(static_cast<double>(s.normal_depth), static_cast<double>(scale), 40) << "\n";
+        frame << "Intake       " << setw(7) << s.intake_depth << "   deferred " << s.deferred << "\n\n";
+
+        frame << "Arrived " << s.arrived << "   served " << s.served << "   throughput "
+              << fixed << setprecision(1) << s.served_per_minute << "/min\n";
+
+        // Wait percentiles over the recent window
+        vector<SimTime> waits = s.recent_waits;
+        frame << "Waits (last " << waits.size() << " served):";
+        if (!waits.empty()) {
+            sort(waits.begin(), waits.end());
+            for (int pct : {50, 90, 99}) {
+                SimTime w = waits[min(waits.size() - 1, waits.size() * pct / 100)];
+                frame << "  p" << pct << " " << setprecision(1) << static_cast<double>(w) / ms_per_minute << " min";
             }
-        } catch (const exception& e) {
-            cout << "Error while serving urgent patients: " << e.what() << endl;
         }
+        frame << "\n\n";
+
+        // Total depth over recent publishes, one column each, scaled to 8 rows
+        int peak = 1;
+        for (int d : s.depth_history) peak = max(peak, d);
+        frame << "Queue depth (peak " << peak << ")\n";
+        for (int row = 8; row >= 1; row--) {
+            frame << "  |";
+            for (int d : s.depth_history) frame << (d * 8 >= row * peak ? '#' : ' ');
+            frame << "\n";
+        }
+        frame << "  +" << string(s.depth_history.size(), '-') << "\n\n";
+
+        frame << bold << "Recent events" << reset << "\n";
+        for (const string& e : s.events) frame << "  " << e.substr(0, 100) << "\n";
     }
 
-    // Serve normal patients if there's room
-    while (served < max_to_serve && !normal_queue.empty()) {
-        try {
-            if (!normal_queue.empty()) {
-                Patient p = normal_queue.front();
-                normal_queue.pop();  // Remove patient from normal queue
-
-                // Calculate waiting time for normal patients
-                int waiting_time = minute - p.getArrivalMinute();
-                
-                if (waiting_time > 10) {
-                    // Skip serving if the patient has been waiting too long
-                    continue;
-                }
+    void run() {
+        auto frame_time = chrono::duration<double>(1.0 / fps);
+        unique_lock<mutex> guard(lock);
+        while (!stopping) {
+            wake.wait_for(guard, frame_time, [this] { return stopping; });
+            shared_ptr<const DashboardSnapshot> snapshot = latest;
+            guard.unlock();
+            if (snapshot) {
+                ostringstream frame;
+                render(*snapshot, frame);
+                out << frame.str() << flush;  // One write per frame to avoid flicker
+            }
+            guard.lock();
+        }
+    }
 
-                served_patients.push_back(p);  // Add patient to the served list
-                total_waiting_time += waiting_time;  // Add waiting time to the total
-                served++;  // Increment the served patient count
-            } else {
-                throw runtime_error("Normal queue is empty!");  // Error if normal queue is empty
+public:
+    Dashboard(ostream& out, double fps) : out(out), fps(fps) {
+        if (fps <= 0) throw invalid_argument("Dashboard frame rate must be positive.");
+    }
+    Dashboard(const Dashboard&) = delete;
+    Dashboard& operator=(const Dashboard&) = delete;
+    ~Dashboard() { stop(); }
+
+    void start() {
+        out << "\x1b[?25l";  // Hide the cursor while drawing
+        renderer = thread(&Dashboard::run, this);
+    }
+
+    // Make a snapshot the one drawn from the next frame on
+    void publish(shared_ptr<const DashboardSnapshot> snapshot) {
+        lock_guard<mutex> guard(lock);
+        latest = move(snapshot);
+    }
+
+    // Stop the render thread after drawing the latest snapshot once more
+    void stop() {
+        {
+            lock_guard<mutex> guard(lock);
+            if (stopping || !renderer.joinable()) return;
+            stopping = true;
+        }
+        wake.notify_all();
+        renderer.join();
+        if (latest) {
+            ostringstream frame;
+            render(*latest, frame);
+            out << frame.str();
+        }
+        out << "\x1b[?25h" << flush;  // Show the cursor again
+    }
+};
+
+// Print one served-history record on a single line
+void printServedRecord(const ServedRecord& r) {
+    cout << r.idString() << " " << r.gender << " " << (r.urgent ? "Urgent" : "Normal")
+         << " arrived " << formatTime(r.arrival)
+         << " served " << formatTime(r.served)
+         << " waited " << fixed << setprecision(1) << static_cast<double>(r.wait()) / ms_per_minute << " min\n";
+}
+
+// Handle a history command ("served", "history" or "longest"); returns false if the input is not one.
+// `minute` is the current simulated minute: clock times refer to its day unless a day is given.
+bool handleHistoryCommand(const string& input, const ServedHistory& history, const ArchiveStore& archive, int64_t minute) {
+    stringstream ss(input);
+    string command;
+    ss >> command;
+
+    if (command == "served") {
+        // served <ID>: when was this patient served?
+        string id;
+        ss >> id;
+        size_t matches = 0;
+        for (const auto& stored : archive.snapshot()) {
+            auto segment = ArchiveStore::load(stored);  // Spilled weeks are read back one at a time
+            for (size_t index : segment->history.findById(id)) {
+                cout << "[day " << segment->first_day << (segment->first_day != segment->last_day ? "+" : "") << "] ";
+                printServedRecord(segment->history.at(index));
+                matches++;
             }
-        } catch (const exception& e) {
-            cout << "Error while serving normal patients: " << e.what() << endl;
         }
+        for (size_t index : history.findById(id)) {
+            printServedRecord(history.at(index));
+            matches++;
+        }
+        if (matches == 0) cout << "Patient " << id << " has not been served.\n";
+        return true;
+    }
+    if (command == "history") {
+        // history [day] <HH:MM> <HH:MM> [Urgent|Normal] [M|F]; earlier days are answered from the archive
+        string from, to, filter;
+        ss >> from;
+        int64_t today = minute / minutes_per_day;
+        int64_t day = today;
+        if (from.find(':') == string::npos) {
+            day = stoll(from);
+            if (day < 0 || day > today) throw invalid_argument("Day must be between 0 and " + to_string(today) + ".");
+            ss >> from;
+        }
+        ss >> to;
+        HistoryQuery q;
+        q.from_minute = day * minutes_per_day + parseClock(from);
+        q.to_minute = day * minutes_per_day + parseClock(to);
+        while (ss >> filter) {
+            for (char& c : filter) c = toupper(c);
+            if (filter == "URGENT") q.type = 'U';
+            else if (filter == "NORMAL") q.type = 'N';
+            else if (filter == "M" || filter == "F") q.gender = filter[0];
+            else throw invalid_argument("Unknown history filter '" + filter + "'.");
+        }
+        shared_ptr<const ArchiveSegment> segment;  // Keeps an archived day's history alive while printing
+        const ServedHistory* source = &history;
+        if (day < today) {
+            for (const auto& stored : archive.snapshot()) {
+                if (stored->first_day <= day && day <= stored->last_day) segment = ArchiveStore::load(stored);
+            }
+            if (!segment) {
+                cout << "Day " << day << " is not archived yet.\n";
+                return true;
+            }
+            source = &segment->history;
+        }
+        vector<size_t> found = source->query(q);
+        for (size_t index : found) printServedRecord(source->at(index));
+        cout << found.size() << " matching patient(s).\n";
+        return true;
     }
+    if (command == "longest") {
+        // longest <k>: the k longest waits so far
+        size_t k = 10;
+        ss >> k;
+        for (size_t index : history.longestWaits(k)) printServedRecord(history.at(index));
+        return true;
+    }
+    return false;
+}
 
-    total_served += served;  // Update total number of served patients
+// Handle "report" (text heatmaps on screen) or "report csv <file>"; returns false if the input is not one
+template <class Policy>
+bool handleReportCommand(const string& input, Scheduler<Policy>& scheduler) {
+    stringstream ss(input);
+    string command, format, path;
+    ss >> command >> format >> path;
+    if (command != "report") return false;
+
+    // Spilled weeks are read back and folded in one at a time, so the report never holds the whole archive
+    vector<shared_ptr<const ArchiveSegment>> resident, spilled;
+    for (const auto& segment : scheduler.archiveStore().snapshot()) (segment->spilled() ? spilled : resident).push_back(segment);
+    WaitHeatmapReport report = WaitHeatmapReport::build(resident,
+                                                        scheduler.servedHistory(),
+                                                        scheduler.timeSeries().all(),
+                                                        thread::hardware_concurrency());
+    for (const auto& segment : spilled) {
+        report.merge(WaitHeatmapReport::build({ArchiveStore::load(segment)}, ServedHistory(), {}, thread::hardware_concurrency()));
+    }
+    if (format == "csv") {
+        ofstream out(path);
+        if (!out) throw runtime_error("Could not open report file '" + path + "'.");
+        report.writeCsv(out);
+        cout << "Report written to " << path << "\n";
+    } else {
+        report.writeText(cout);
+    }
+    return true;
 }
 
-// Display the current state of the urgent and normal queues
-void Scheduler::displayQueues() {
-    cout << "\nCurrent State of Queues:\n";
+// Handle "book <ID> <M/F> <HH:MM>", "cancel <ID>" or "nextslot <HH:MM>"; returns false if the input is not one
+template <class Policy>
+bool handleAppointmentCommand(const string& input, Scheduler<Policy>& scheduler, int minute) {
+    stringstream ss(input);
+    string command;
+    ss >> command;
 
-    // Display the IDs of patients in the urgent queue
-    cout << "Urgent Queue: ";
-    queue<Patient> temp_urgent = urgent_queue;
-    while (!temp_urgent.empty()) {
-        cout << temp_urgent.front().getId() << " ";
-        temp_urgent.pop();
+    // Clock times refer to the current simulated day
+    int day_start = minute - minute % minutes_per_day;
+    if (command == "book") {
+        string id, clock;
+        char gender = 0;
+        ss >> id >> gender >> clock;
+        gender = static_cast<char>(toupper(gender));
+        if (id.empty() || (gender != 'M' && gender != 'F')) {
+            throw invalid_argument("Usage: book <ID> <M/F> <HH:MM>");
+        }
+        if (id.size() > sizeof(ServedRecord::id)) throw invalid_argument("Patient ID must be 1 to 14 characters.");
+        int slot = day_start + parseClock(clock);
+        if (slot <= minute) throw invalid_argument("Appointments must be booked for a later minute.");
+        scheduler.bookAppointment(Patient(id, gender, clock, Policy::normal_type, slot * ms_per_minute), slot);
+        cout << "Booked " << id << " at " << formatClock(slot) << ".\n";
+        return true;
     }
-    cout << endl;
+    if (command == "cancel") {
+        string id;
+        ss >> id;
+        cout << (scheduler.cancelAppointment(id) ? "Cancelled appointment for " : "No appointment for ") << id << ".\n";
+        return true;
+    }
+    if (command == "nextslot") {
+        string clock;
+        ss >> clock;
+        int from = clock.empty() ? minute + 1 : max(minute + 1, day_start + parseClock(clock));
+        cout << "Next free slot: " << formatClock(scheduler.appointments().nextFreeSlot(from)) << "\n";
+        return true;
+    }
+    return false;
+}
 
-    // Display the IDs of patients in the normal queue
-    cout << "Normal Queue: ";
-    queue<Patient> temp_normal = normal_queue;
-    while (!temp_normal.empty()) {
-        cout << temp_normal.front().getId() << " ";
-        temp_normal.pop();
+// Add clinicians to the roster and show who is free; returns true if the input was a clinician command
+template <class Policy>
+bool handleClinicianCommand(const string& input, Scheduler<Policy>& scheduler) {
+    stringstream ss(input);
+    string command;
+    ss >> command;
+
+    if (command == "clinician") {
+        string name, skills;
+        ss >> name >> skills;
+        if (name.empty()) throw invalid_argument("Usage: clinician <name> [skill,skill,...]");
+        uint32_t mask = skills.empty() ? 0 : parseSkills(skills);
+        int c = scheduler.clinicians().addClinician(name, mask);
+        cout << "Clinician " << c << ": " << name << " (" << formatSkills(mask) << ")\n";
+        return true;
     }
-    cout << endl;
+    if (command == "clinicians") {
+        if (scheduler.clinicians().size() == 0) cout << "No clinicians on the roster; any server treats any patient.\n";
+        scheduler.clinicians().displayStatistics();
+        return true;
+    }
+    return false;
+}
 
-    // Display the IDs of currently served patients
-    cout << "Currently Served Patients: ";
-    for (const auto& p : served_patients) {
-        cout << p.getId() << " ";
+// Add departments and show how service was shared; returns true if the input was a department command
+template <class Policy>
+bool handleDepartmentCommand(const string& input, Scheduler<Policy>& scheduler) {
+    stringstream ss(input);
+    string command;
+    ss >> command;
+
+    if (command == "department") {
+        string name, weight_text;
+        ss >> name >> weight_text;
+        if (name.empty()) throw invalid_argument("Usage: department <name> [weight]");
+        int weight = weight_text.empty() ? 1 : stoi(weight_text);
+        int index = scheduler.addDepartment(name, weight);
+        cout << "Department " << index << ": " << name << " (weight " << weight << ")\n";
+        return true;
     }
-    cout << endl;
+    if (command == "departments") {
+        scheduler.displayDepartments();
+        return true;
+    }
+    return false;
 }
 
-// Display the overall simulation statistics
-void Scheduler::displayStatistics() {
-    cout << "\nSimulation Summary:\n";
-    cout << "Total Patients: " << total_patients << endl;
-    cout << "Urgent Patients: " << total_urgent << endl;
-    cout << "Normal Patients: " << total_normal << endl;
-    cout << "Total Served Patients: " << total_served << endl;
+// Answer operator queries about waiting patients and the queues; returns true if the input was one.
+// Every answer comes from indices and counters kept as patients come and go, so none of them
+// scans the queues or the served history; only the intake buffer, bounded by its watermark, is searched.
+template <class Policy>
+bool handleQueryCommand(const string& input, const Scheduler<Policy>& scheduler, const IntakeBuffer& intake, SimTime now) {
+    stringstream ss(input);
+    string command;
+    ss >> command;
 
-    // Calculate and display average waiting time
-    if (total_served > 0) {
-        double avg_waiting_time = static_cast<double>(total_waiting_time) / total_served;
-        cout << "Average Waiting Time: " << fixed << setprecision(2) << avg_waiting_time << " minutes" << endl;
-    } else {
-        cout << "Average Waiting Time: N/A (no patients served)" << endl;
+    auto describeQueue = [&](const typename Scheduler<Policy>::WaitingPlace& place) {
+        return string(place.urgent ? "urgent" : "normal") + " queue"
+               + (place.department == 0 ? "" : " of " + scheduler.departmentName(place.department));
+    };
+
+    if (command == "status") {
+        // status <ID>: waiting, deferred, booked or served?
+        string id;
+        ss >> id;
+        if (id.empty()) throw invalid_argument("Usage: status <ID>");
+        typename Scheduler<Policy>::WaitingPlace place;
+        size_t pending = 0;
+        if (intake.findPending(id, pending)) {
+            cout << "Patient " << id << " is registered and pending admission, number " << pending + 1
+                 << " in the intake buffer.\n";
+        } else if (scheduler.locate(id, place)) {
+            cout << "Patient " << id << " is waiting in the " << describeQueue(place) << " since " << formatTime(place.arrival)
+                 << " (" << fixed << setprecision(1) << static_cast<double>(now - place.arrival) / ms_per_minute
+                 << " min), number " << place.position + 1 << " in line; predicted wait was "
+                 << static_cast<double>(place.predicted) / ms_per_minute << " min.\n";
+        } else if (scheduler.isDeferred(id)) {
+            cout << "Patient " << id << " was asked to return later and has not come back yet.\n";
+        } else if (scheduler.appointments().slotOf(id) >= 0) {
+            cout << "Patient " << id << " has an appointment at " << formatClock(scheduler.appointments().slotOf(id)) << ".\n";
+        } else {
+            vector<size_t> found = scheduler.servedHistory().findById(id);
+            for (size_t index : found) printServedRecord(scheduler.servedHistory().at(index));
+            if (found.empty()) cout << "Patient " << id << " is not waiting and has not been served today.\n";
+        }
+        return true;
+    }
+    if (command == "position") {
+        // position <ID>: how many patients will be seen first
+        string id;
+        ss >> id;
+        if (id.empty()) throw invalid_argument("Usage: position <ID>");
+        typename Scheduler<Policy>::WaitingPlace place;
+        size_t pending = 0;
+        if (intake.findPending(id, pending)) {
+            cout << "Patient " << id << " is pending admission and has no place in line until the intake buffer is drained.\n";
+        } else if (!scheduler.locate(id, place)) {
+            cout << "Patient " << id << " is not waiting.\n";
+        } else {
+            cout << "Patient " << id << " is number " << place.position + 1 << " in the " << describeQueue(place) << "; "
+                 << place.ahead << " patient(s) will be seen first.\n";
+        }
+        return true;
     }
+    if (command == "stats") {
+        // stats urgent|normal: outcomes for one class of patient
+        string type;
+        ss >> type;
+        for (char& c : type) c = toupper(c);
+        if (type != "URGENT" && type != "NORMAL") throw invalid_argument("Usage: stats urgent|normal");
+        bool urgent = type == "URGENT";
+        const ClassTotals& totals = scheduler.classTotals(urgent);
+        cout << (urgent ? "Urgent" : "Normal") << " patients: " << scheduler.totalArrivals(urgent) << " arrived, "
+             << scheduler.queueDepth(urgent) << " waiting, " << totals.served << " served, " << totals.expired << " expired\n";
+        cout << "Average wait " << fixed << setprecision(2)
+             << (totals.served ? static_cast<double>(totals.waiting_time) / totals.served / ms_per_minute : 0.0)
+             << " minutes, longest " << static_cast<double>(totals.longest_wait) / ms_per_minute << " minutes\n";
+        scheduler.waitPredictor().displayStatistics(urgent);
+        return true;
+    }
+    if (command == "top-waits") {
+        // top-waits <k>: the k patients waiting longest right now
+        size_t k = 10;
+        ss >> k;
+        for (const Patient& p : scheduler.longestWaiting(k)) {
+            cout << p.getId() << " " << p.getGender() << " " << p.getType() << " arrived " << formatTime(p.getArrivalStamp())
+                 << " waiting " << fixed << setprecision(1) << static_cast<double>(now - p.getArrivalStamp()) / ms_per_minute << " min\n";
+        }
+        return true;
+    }
+    if (command == "depths") {
+        scheduler.displayDepths();
+        return true;
+    }
+    if (command == "depth-history") {
+        // depth-history <n>: queue depths at the end of each of the last n minutes
+        size_t n = 60;
+        ss >> n;
+        const vector<QueueSnapshot>& all = scheduler.timeSeries().all();
+        for (size_t i = all.size() - min(n, all.size()); i < all.size(); i++) {
+            const QueueSnapshot& m = all[i];
+            cout << formatClock(m.minute) << "  urgent " << setw(5) << m.urgent_depth << "  normal " << setw(5) << m.normal_depth
+                 << "  " << string(min(60, (m.urgent_depth + m.normal_depth) / 5), '#') << "\n";
+        }
+        if (all.empty()) cout << "No complete minutes recorded today.\n";
+        return true;
+    }
+    return false;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
     srand(time(0));  // Seed the random number generator for random patient data
 
-    Scheduler scheduler;  // Create a scheduler instance
-    int minute = 0;       // Initialize the time variable
+    // Command-line options
+    string profile_path;  // Collapsed-stack output of the sampling profiler, if enabled
+    bool run_benchmarks = false;
+    int replications = 0;  // Monte Carlo replications per scenario, if a study was requested
+    AdmissionMode admission_mode = AdmissionMode::Off;
+    double admission_threshold = DefaultPolicy::max_wait * 0.8;  // Minutes of expected wait
+    SimTime tick_ms = ms_per_minute;  // Simulated time per 'next'
+    size_t intake_high = 200, intake_low = 100;  // Intake buffer watermarks
+    size_t intake_per_tick = 50;                 // Registrations the core takes in per tick
+    const Scenario* feed_scenario = nullptr;     // Scenario a background registration feed replays
+    string generate_path, replay_path;           // Dataset file to write, or to replay
+    string convert_in, convert_out;              // CSV <-> dataset conversion
+    uint64_t generate_count = 0;
+    const Scenario* generate_scenario = &standard_scenarios[1];
+    uint64_t generate_seed = 1;
+    double dashboard_fps = 0;                    // Frame rate of the terminal dashboard, if enabled
+    double ticks_per_second = 10;                // Pace of the dashboard run; 0 runs as fast as possible
+    auto findScenario = [](const string& name) -> const Scenario* {
+        for (const Scenario& scenario : standard_scenarios) {
+            if (name == scenario.name) return &scenario;
+        }
+        return nullptr;
+    };
+    for (int i = 1; i < argc; i++) {
+        string option = argv[i];
+        if (option == "--perf") {
+            PerfProfiler::start(cout);  // Read hardware counters around the hot paths, if allowed
+        } else if (option == "--profile" && i + 1 < argc) {
+            profile_path = argv[++i];
+        } else if (option == "--bench") {
+            run_benchmarks = true;
+        } else if (option == "--replications" && i + 1 < argc) {
+            replications = atoi(argv[++i]);
+            if (replications <= 0) {
+                cout << "--replications must be positive.\n";
+                return 1;
+            }
+        } else if (option == "--admission" && i + 1 < argc) {
+            string mode = argv[++i];
+            if (mode == "off") admission_mode = AdmissionMode::Off;
+            else if (mode == "defer") admission_mode = AdmissionMode::Defer;
+            else if (mode == "redirect") admission_mode = AdmissionMode::Redirect;
+            else {
+                cout << "--admission must be off, defer or redirect.\n";
+                return 1;
+            }
+        } else if (option == "--admission-threshold" && i + 1 < argc) {
+            admission_threshold = atof(argv[++i]);
+            if (admission_threshold <= 0) {
+                cout << "--admission-threshold must be a positive number of minutes.\n";
+                return 1;
+            }
+        } else if (option == "--intake" && i + 3 < argc) {
+            intake_high = strtoul(argv[++i], nullptr, 10);
+            intake_low = strtoul(argv[++i], nullptr, 10);
+            intake_per_tick = strtoul(argv[++i], nullptr, 10);
+            if (intake_high == 0 || intake_low >= intake_high || intake_per_tick == 0) {
+                cout << "--intake takes <high> <low> <per-tick> with low < high and per-tick > 0.\n";
+                return 1;
+            }
+        } else if (option == "--feed" && i + 1 < argc) {
+            feed_scenario = findScenario(argv[++i]);
+            if (!feed_scenario) {
+                cout << "Unknown scenario '" << argv[i] << "' for --feed.\n";
+                return 1;
+            }
+        } else if (option == "--generate" && i + 2 < argc) {
+            generate_path = argv[++i];
+            generate_count = strtoull(argv[++i], nullptr, 10);
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                generate_scenario = findScenario(argv[++i]);
+                if (!generate_scenario) {
+                    cout << "Unknown scenario '" << argv[i] << "' for --generate.\n";
+                    return 1;
+                }
+            }
+        } else if (option == "--seed" && i + 1 < argc) {
+            generate_seed = strtoull(argv[++i], nullptr, 10);
+        } else if (option == "--convert" && i + 2 < argc) {
+            convert_in = argv[++i];
+            convert_out = argv[++i];
+        } else if (option == "--replay" && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (option == "--dashboard" && i + 1 < argc) {
+            dashboard_fps = atof(argv[++i]);
+            if (dashboard_fps <= 0 || dashboard_fps > 60) {
+                cout << "--dashboard takes a frame rate between 0 and 60.\n";
+                return 1;
+            }
+        } else if (option == "--speed" && i + 1 < argc) {
+            ticks_per_second = atof(argv[++i]);
+            if (ticks_per_second < 0) {
+                cout << "--speed must be a number of ticks per second, or 0 for unpaced.\n";
+                return 1;
+            }
+        } else if (option == "--tick-ms" && i + 1 < argc) {
+            tick_ms = atoll(argv[++i]);
+            if (tick_ms <= 0 || ms_per_minute % tick_ms != 0) {
+                cout << "--tick-ms must be a positive divisor of " << ms_per_minute << ".\n";
+                return 1;
+            }
+        } else {
+            cout << "Unknown option '" << option << "'. Supported: --perf, --profile <file>, --bench, --replications <n>, --admission <off|defer|redirect>, --admission-threshold <min>, --intake <high> <low> <per-tick>, --feed <scenario>, --generate <file> <count> [scenario], --seed <n>, --replay <file>, --convert <in> <out>, --dashboard <fps>, --speed <ticks/s>, --tick-ms <n>\n";
+            return 1;
+        }
+    }
+    if (!profile_path.empty() && !SamplingProfiler::start(cout)) {
+        profile_path.clear();
+    }
+
+    // Dataset mode: write a generated patient file and exit
+    if (!generate_path.empty()) {
+        return generateDataset<DefaultPolicy>(generate_path, generate_count, *generate_scenario, generate_seed, cout) ? 0 : 1;
+    }
+
+    // Conversion mode: CSV export to dataset file or back, then exit
+    if (!convert_in.empty()) {
+        return convertDataset(convert_in, convert_out, cout) ? 0 : 1;
+    }
+
+    // Benchmark modes: run the scenario matrix or a replication study instead of the interactive simulation
+    if (run_benchmarks || replications > 0) {
+        if (run_benchmarks) runBenchmarks<DefaultPolicy>(cout);
+        if (replications > 0) runReplicationStudy<DefaultPolicy>(cout, replications);
+        PerfProfiler::report(cout);
+        if (!profile_path.empty()) {
+            SamplingProfiler::stopAndWrite(profile_path, cout);
+        }
+        return 0;
+    }
+
+    Scheduler<DefaultPolicy> scheduler(tick_ms);  // Create a scheduler with the hospital's fixed rules
+    scheduler.admissionControl().configure(admission_mode, admission_threshold);
+    SimTime now = 0;      // Initialize the simulation clock (milliseconds)
+
+    // Append per-minute queue snapshots to a binary file for later analysis
+    if (!scheduler.timeSeries().open("queue_timeseries.dat")) {
+        cout << "Warning: could not open queue_timeseries.dat; time series kept in memory only.\n";
+    }
+    scheduler.archiveStore().setSpillPrefix("queue_archive_");  // Archived weeks live on disk until exit
+
+    // Set up the ward: two male and two female bays of 16 beds
+    scheduler.beds().addBay('M', 16);
+    scheduler.beds().addBay('M', 16);
+    scheduler.beds().addBay('F', 16);
+    scheduler.beds().addBay('F', 16);
+
+    // Start with the same 100 patients every run, taken from the compile-time seed table
+    for (const SeedPatient& seed : startup_population) {
+        scheduler.addPatient(seed.toPatient(now));
+    }
+
+    // Patients from a dataset file join at their recorded arrival times
+    unique_ptr<PatientFile> replay;
+    size_t replay_next = 0;
+    if (!replay_path.empty()) {
+        try {
+            replay.reset(new PatientFile(replay_path));
+        } catch (const exception& e) {
+            cout << e.what() << "\n";
+            return 1;
+        }
+        cout << "Replaying " << replay->size() << " patients from " << replay_path << ", arriving "
+             << formatTime(replay->info().first_arrival) << " to " << formatTime(replay->info().last_arrival) << ".\n";
+    }
+
+    // Registrations reach the core through a bounded intake buffer. The front desk is refused
+    // outright when the core is behind; the optional background feed is made to wait instead.
+    IntakeBuffer intake(intake_high, intake_low);
+    int desk = intake.addSource("desk", Backpressure::Nack);
+    atomic<bool> feed_done(feed_scenario == nullptr);
+    thread feed;
+    if (feed_scenario) {
+        int feed_source = intake.addSource("feed", Backpressure::Block);
+        feed = thread([&, feed_source] {
+            mt19937 rng(static_cast<unsigned>(time(0)));
+            for (int minute = 0; minute < feed_scenario->minutes; minute++) {
+                for (Patient& p : PatientGenerator::generateArrivals(minute * ms_per_minute, ms_per_minute, rng,
+                                                                      feed_scenario->paramsAt(minute))) {
+                    if (!intake.submit(feed_source, move(p))) {
+                        feed_done = true;
+                        return;  // Intake closed
+                    }
+                }
+            }
+            feed_done = true;
+        });
+    }
+
+    // One tick of the simulation: take in arrivals, serve, and advance the clock. Anything worth
+    // reporting is added to `events`; returns true once every patient has been served.
+    auto advanceTick = [&](vector<string>& events) {
+        // Randomly determine how many patients to serve (between 5 and 10 per minute by default)
+        int max_to_serve = scheduler.drawTickCapacity();
+
+        // Take in this tick's share of registrations; they arrive now. Admission control may turn
+        // some away during a surge.
+        vector<Patient> registered;
+        intake.drain(intake_per_tick, registered);
+        string deferred_ids, redirected_ids;
+        for (Patient& patient : registered) {
+            patient.setArrivalStamp(now);
+            SimTime predicted = 0;
+            AdmissionController::Decision decision = scheduler.offerPatient(patient, now, &predicted);
+            // Tell the front desk what to expect, unless a feed has brought in too many to list
+            if (decision == AdmissionController::Admit && registered.size() <= 10) {
+                ostringstream told;
+                told << patient.getId() << " joined the " << (patient.getType() == DefaultPolicy::urgent_type ? "urgent" : "normal")
+                     << " queue; predicted wait " << fixed << setprecision(1) << static_cast<double>(predicted) / ms_per_minute << " min.";
+                events.push_back(told.str());
+            }
+            if (decision == AdmissionController::Defer) deferred_ids += " " + patient.getId();
+            if (decision == AdmissionController::Redirect) redirected_ids += " " + patient.getId();
+        }
+        if (!deferred_ids.empty()) {
+            events.push_back("Expected wait too long; asked to return in " + to_string(AdmissionController::defer_minutes)
+                             + " minutes:" + deferred_ids);
+        }
+        if (!redirected_ids.empty()) {
+            events.push_back("Expected wait too long; redirected to another facility:" + redirected_ids);
+        }
+
+        // Replayed patients keep their recorded arrival times
+        size_t replayed = 0;
+        for (; replay && replay_next < replay->size() && (*replay)[replay_next].arrival <= now; replay_next++, replayed++) {
+            scheduler.offerPatient((*replay)[replay_next].toPatient(), now);
+        }
+        if (replayed > 0) events.push_back(to_string(replayed) + " patients arrived from the replay file.");
+
+        {
+            PerfScope tick(PerfRegion::Tick);
+            int served_before = scheduler.totalServed();
+            scheduler.servePatients(max_to_serve, now);  // Serve patients for this tick
+            scheduler.recordTick(now);  // Append to the queue time series on minute boundaries
+            tick.setPatients(scheduler.totalServed() - served_before);
+        }
+
+        // Increment time (one tick has passed)
+        now += tick_ms;
+
+        // Both queues empty and no appointments or registrations left signals the end of the simulation
+        return scheduler.isUrgentQueueEmpty() && scheduler.isNormalQueueEmpty() && scheduler.appointments().size() == 0
+               && scheduler.deferredCount() == 0 && intake.depth() == 0 && feed_done
+               && (!replay || replay_next == replay->size());
+    };
+
+    // Dashboard mode: run unattended on arrivals from --feed or --replay, drawing the dashboard
+    // instead of prompting. The simulation only builds and publishes snapshots; the dashboard's
+    // own thread does all terminal output.
+    if (dashboard_fps > 0) {
+        Dashboard dashboard(cout, dashboard_fps);
+        DashboardSnapshot shown;            // Rolling state carried from one snapshot to the next
+        deque<string> events;
+        int history_day = 0;                // Day of the served history being sampled for waits
+        size_t history_seen = 0;            // Records of that day's history already sampled
+        const size_t wait_window = 500;     // Recent waits kept for percentiles
+        size_t wait_next = 0;
+        deque<pair<SimTime, int>> served_at;  // (time, total served) after each tick of the last hour
+        auto publish_every = chrono::duration<double>(0.5 / dashboard_fps);  // Twice the frame rate is enough
+        auto last_publish = chrono::steady_clock::now() - chrono::hours(1);
+        auto publish = [&](bool finished) {
+            served_at.emplace_back(now, scheduler.totalServed());
+            while (served_at.size() > 1 && served_at.front().first < now - 60 * ms_per_minute) served_at.pop_front();
+            auto wall = chrono::steady_clock::now();
+            if (!finished && wall - last_publish < publish_every) return;  // Nobody would see it
+            last_publish = wall;
+
+            // Waits of patients served since the last snapshot. The history restarts at midnight, so a
+            // new day starts from its first record, however many it has gathered since.
+            const ServedHistory& history = scheduler.servedHistory();
+            if (scheduler.servedHistoryDay() != history_day) {
+                history_day = scheduler.servedHistoryDay();
+                history_seen = 0;
+            }
+            for (; history_seen < history.size(); history_seen++) {
+                SimTime wait = history.at(history_seen).wait();
+                if (shown.recent_waits.size() < wait_window) {
+                    shown.recent_waits.push_back(wait);
+                } else {
+                    shown.recent_waits[wait_next] = wait;
+                    wait_next = (wait_next + 1) % wait_window;
+                }
+            }
+
+            SimTime span = served_at.back().first - served_at.front().first;
 
-    // Generate a list of 100 random patients and add them to the scheduler
-    vector<Patient> patients = PatientGenerator::generatePatients(100, minute);
-    for (auto& p : patients) {
-        scheduler.addPatient(p);
+            shown.now = now;
+            shown.urgent_depth = scheduler.queueDepth(true);
+            shown.normal_depth = scheduler.queueDepth(false);
+            shown.intake_depth = intake.depth();
+            shown.deferred = scheduler.deferredCount();
+            shown.arrived = scheduler.totalPatients();
+            shown.served = scheduler.totalServed();
+            shown.served_per_minute = span > 0 ? (served_at.back().second - served_at.front().second)
+                                                     * static_cast<double>(ms_per_minute) / span : 0;
+            shown.depth_history.push_back(static_cast<int>(shown.urgent_depth + shown.normal_depth));
+            if (shown.depth_history.size() > 60) shown.depth_history.erase(shown.depth_history.begin());
+            shown.events.assign(events.begin(), events.end());
+            shown.finished = finished;
+            dashboard.publish(make_shared<const DashboardSnapshot>(shown));
+        };
+
+        dashboard.start();
+        auto tick_wall = chrono::duration<double>(ticks_per_second > 0 ? 1.0 / ticks_per_second : 0);
+        auto next_wall = chrono::steady_clock::now();
+        bool finished = false;
+        while (!finished) {
+            vector<string> tick_events;
+            finished = advanceTick(tick_events);
+            for (const string& event : tick_events) {
+                events.push_back(formatTime(now - tick_ms) + "  " + event);
+                if (events.size() > 8) events.pop_front();
+            }
+            publish(finished);
+            if (ticks_per_second > 0) {
+                next_wall += chrono::duration_cast<chrono::steady_clock::duration>(tick_wall);
+                this_thread::sleep_until(next_wall);
+            }
+        }
+        dashboard.stop();
+        cout << "\nAll patients have been served. Ending simulation.\n";
     }
 
-    cout << "Welcome to the Patient Scheduling System!\n";
-    cout << "You can input patient details manually or type 'next' to advance time.\n";
-    cout << "Format: ID Gender(M/F) ArrivalTime(HH:MM) Type(Urgent/Normal)\n";
+    if (dashboard_fps == 0) {
+        cout << "Welcome to the Patient Scheduling System!\n";
+        cout << "You can input patient details manually or type 'next' to advance time.\n";
+        cout << "Format: ID Gender(M/F) ArrivalTime(HH:MM) Type(Urgent/Normal) [skill,skill,...] [dept=<name>]\n";
+        cout << "History: 'served <ID>', 'history [day] <HH:MM> <HH:MM> [Urgent|Normal] [M|F]', 'longest <k>'\n";
+        cout << "Reports: 'report' for wait heatmaps, 'report csv <file>' to save them\n";
+        cout << "Appointments: 'book <ID> <M/F> <HH:MM>', 'cancel <ID>', 'nextslot [HH:MM]'\n";
+        cout << "Clinicians: 'clinician <name> [skill,...]', 'clinicians'; skills are";
+        for (const char* skill : skill_names) cout << " " << skill;
+        cout << "\n";
+        cout << "Departments: 'department <name> [weight]', 'departments'\n";
+        cout << "Intake: 'intake' for buffer depth and throttling per source\n";
+        cout << "Queries: 'status <ID>', 'position <ID>', 'stats urgent|normal', 'top-waits <k>', 'depth-history <minutes>', 'depths'\n";
+        cout << "Memory: 'mem' for heap usage per subsystem\n";
+    }
 
-    // Main program loop
-    while (true) {
-        // Print the current minute to track time progression
-        cout << "\n--- Minute " << minute << " ---\n";
+    // Main program loop (interactive mode)
+    while (dashboard_fps == 0) {
+        // Print the current time to track time progression
+        if (tick_ms == ms_per_minute) {
+            cout << "\n--- Minute " << now / ms_per_minute << " ---\n";
+        } else {
+            cout << "\n--- Time " << formatTime(now) << " ---\n";
+        }
         cout << "Enter patient details or type 'next' to advance time:\n";
 
+        MemScope parser_scope(MemTag::Parser);  // Input handling is charged to the parser
         string input;
         getline(cin, input);  // Get user input for patient details or commands
 
@@ -233,20 +4906,26 @@ int main() {
             continue;  // Prompt user to try again if input is empty
         }
 
+        // Show heap usage per subsystem
+        if (input == "mem") {
+            scheduler.displayMemory();
+            continue;
+        }
+        if (input == "intake") {
+            intake.displayStatistics();
+            continue;
+        }
+
         // If the user types 'next', advance time and serve patients
         if (input == "next") {
-            // Randomly determine how many patients to serve (between 5 and 10)
-            int max_to_serve = rand() % 6 + 5;  
-            scheduler.servePatients(max_to_serve, minute);  // Serve patients for this minute
+            vector<string> events;
+            bool finished = advanceTick(events);
+            for (const string& event : events) cout << event << "\n";
 
             // Display the current state of the queues (Urgent and Normal)
             scheduler.displayQueues();
 
-            // Increment time (one minute has passed)
-            minute++;
-
-            // Check if both queues are empty, signaling the end of the simulation
-            if (scheduler.isUrgentQueueEmpty() && scheduler.isNormalQueueEmpty()) {
+            if (finished) {
                 cout << "All patients have been served. Ending simulation.\n";
                 break;  // Exit the loop if all patients are served
             }
@@ -255,33 +4934,92 @@ int main() {
         }
 
         // Parse the patient details input by the user
-        string id, arrival_time, type;
+        string id, arrival_time, type, option;
         char gender;
 
         try {
+            // Answer queries against the served-patient history
+            if (handleHistoryCommand(input, scheduler.servedHistory(), scheduler.archiveStore(), now / ms_per_minute)) {
+                continue;
+            }
+            if (handleReportCommand(input, scheduler)) {
+                continue;
+            }
+            if (handleAppointmentCommand(input, scheduler, static_cast<int>(now / ms_per_minute))) {
+                continue;
+            }
+            if (handleClinicianCommand(input, scheduler)) {
+                continue;
+            }
+            if (handleDepartmentCommand(input, scheduler)) {
+                continue;
+            }
+            if (handleQueryCommand(input, scheduler, intake, now)) {
+                continue;
+            }
+
             // Use stringstream to parse the input into the appropriate variables
             stringstream ss(input);
             ss >> id >> gender >> arrival_time >> type;
 
             // Normalize the type of patient to uppercase for consistency
             for (char& c : type) c = toupper(c);  // Convert type to uppercase (Urgent/Normal)
+            gender = static_cast<char>(toupper(gender));
+
+            if (id.size() > sizeof(ServedRecord::id)) {
+                throw invalid_argument("Patient ID must be 1 to 14 characters.");
+            }
+
+            // Check the gender, which decides the patient's ward bay
+            if (gender != 'M' && gender != 'F') {
+                throw invalid_argument("Invalid gender. Must be 'M' or 'F'.");
+            }
 
             // Check if the patient type is valid
             if (type != "URGENT" && type != "NORMAL") {
                 throw invalid_argument("Invalid patient type. Must be 'Urgent' or 'Normal'.");
             }
 
-            // Create a new patient object using the parsed data, assigning the current minute as the arrival time
-            Patient patient(id, gender, arrival_time, type, minute);
-            scheduler.addPatient(patient);  // Add the patient to the scheduler
+            // Create a new patient object using the parsed data, assigning the current time as the arrival time
+            type = (type == "URGENT") ? DefaultPolicy::urgent_type : DefaultPolicy::normal_type;  // Use the policy's class name
+            Patient patient(id, gender, arrival_time, type, now);
+            // Optional trailing fields: dept=<name> and a skill list
+            while (ss >> option) {
+                if (option.compare(0, 5, "dept=") == 0) {
+                    int department = scheduler.departmentIndex(option.substr(5));
+                    if (department < 0) throw invalid_argument("Unknown department '" + option.substr(5) + "'.");
+                    patient.setDepartment(department);
+                } else {
+                    patient.setRequiredSkills(parseSkills(option));
+                }
+            }
+            // Register the patient; they join the queue at the next tick unless the core is behind
+            if (intake.submit(desk, patient)) {
+                cout << "Registered " << id << "; joins the queue at the next tick.\n";
+            } else {
+                cout << "Intake is full: registration of " << id << " refused. Please retry after the next tick.\n";
+            }
         } catch (exception& e) {
             // Catch any parsing or validation errors and provide feedback to the user
             cout << "Invalid input: " << e.what() << "\nPlease try again.\n";
         }
     }
 
+    // Stop the registration feed before reporting
+    intake.close();
+    if (feed.joinable()) feed.join();
+
     // After the loop ends, display the final statistics of the simulation
+    scheduler.flushPartialMinute(now);
     scheduler.displayStatistics();
+    intake.displayStatistics();
+    if (MemoryAccounting::enabled()) {
+        scheduler.displayMemory();
+    }
+    PerfProfiler::report(cout);
+    if (!profile_path.empty()) {
+        SamplingProfiler::stopAndWrite(profile_path, cout);
+    }
 
     return 0;  // Return from the main function, ending the program
 }
\ No newline at end of file